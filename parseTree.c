@@ -8,25 +8,58 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
-#include <math.h>
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 
 #define NOT_LOADED_EXCEPTION "not_loaded\n"
-#define INVALID_EXCEPTION    "incorrect\n"
+#define INVALID_RESULT       "incorrect"
+#define INVALID_EXCEPTION    INVALID_RESULT "\n"
 #define SUCCESS              "success\n"
 #define OPERATOR_EXCEPTION   "unknown operator"
 #define OPEN_FILE_EXCEPTION  "can't open file"
+#define OVERFLOW_RESULT      "overflow"
+#define BUDGET_RESULT        "budget_exceeded"
+#define DIVISION_RESULT      "division_by_zero"
+#define OVERFLOW_EXCEPTION   OVERFLOW_RESULT "\n"
+#define BUDGET_EXCEPTION     BUDGET_RESULT "\n"
+#define DIVISION_EXCEPTION   DIVISION_RESULT "\n"
 #define INPUT_FILE           "input.txt"
 #define OUTPUT_FILE          "output.txt"
 
+/// Error that stopped an evaluation
+typedef enum EvaluationError {
+    NO_ERROR,       // The value is calculated
+    OVERFLOW_ERROR, // The value of '!', '^' or '/' does not fit into int
+    BUDGET_ERROR,   // The operation or time budget is spent
+    DIVISION_ERROR, // '/' or '%' by zero
+    UNBOUND_ERROR,  // A variable is not set in the context
+    MEMORY_ERROR    // Not enough memory for the evaluation
+} EvaluationError;
+
+/// Limits of one evaluation and the first error it met
+typedef struct Evaluation {
+    /// Number of operations performed
+    unsigned long long operations;
+    /// Maximum number of operations (0 - unlimited)
+    unsigned long long operationsLimit;
+    /// Time (TIME_UTC, in nanoseconds) by which the evaluation must end (0 - unlimited)
+    long long deadline;
+    /// First error
+    EvaluationError error;
+} Evaluation;
+
 /// Context of an expression (certain variables)
 typedef struct Context {
     /// Variable name string
     char *variablesNames;
     /// Variable value set
     int *variablesValues;
+    /// Limits and errors of the evaluation (NULL - no limits)
+    Evaluation *evaluation;
 } Context;
 
 /// Form of expression
@@ -142,28 +175,79 @@ typedef struct BinaryExpression {
 
 DEFINE_EXPRESSION_CAST(BinaryExpression, BINARY);
 
-/// Recursively release memory under the expression
+/// Release memory under the expression.
+///     Nodes are released one at a time without recursion:
+///         a binary left side is rotated up above its parent, so the left side is always released first.
 void freeExpression(Expression *expr) {
-    if (expr == NULL) { return; }
+    while (expr != NULL) {
+        Expression *next = NULL;
+        switch (expr->kind) {
+            case LITERAL:
+                break;
+            case VARIABLE:
+                break;
+            case PARENTHESIS:
+                next = asParenthesis(expr)->expression;
+                break;
+            case UNARY:
+                next = asUnaryExpression(expr)->operand;
+                break;
+            case BINARY: {
+                BinaryExpression *binary = asBinaryExpression(expr);
+                Expression *left = binary->left;
+                if (left != NULL && left->kind == BINARY) {
+                    /// Rotation: the left side becomes the parent of the node
+                    binary->left = asBinaryExpression(left)->right;
+                    asBinaryExpression(left)->right = expr;
+                    expr = left;
+                    continue;
+                }
+                if (left != NULL && (left->kind == PARENTHESIS || left->kind == UNARY)) {
+                    /// The operand of the left side takes its place
+                    binary->left = left->kind == PARENTHESIS
+                                   ? asParenthesis(left)->expression
+                                   : asUnaryExpression(left)->operand;
+                    free(left);
+                    continue;
+                }
+                free(left);
+                next = binary->right;
+                break;
+            }
+        }
 
-    switch (expr->kind) {
-        case LITERAL:
-            break;
-        case VARIABLE:
-            break;
+        free(expr);
+        expr = next;
+    }
+}
+
+/**
+ * @param:  kind       - PARENTHESIS, UNARY or BINARY
+ * @param:  data       - specific expression data with already made subexpressions
+ * @param:  dataSizeof - class size of a particular expression (sizeof(...))
+ * @return: abstract expression, NULL if there is not enough memory
+ * @brief:  Make an expression that owns subexpressions,
+ *              the subexpressions are released if it cannot be made
+ */
+Expression *makeCompoundExpression(ExpressionKind kind, void *data, size_t dataSizeof) {
+    Expression *expression = makeExpression(kind, data, dataSizeof);
+    if (expression != NULL) { return expression; }
+
+    switch (kind) {
         case PARENTHESIS:
-            freeExpression(asParenthesis(expr)->expression);
+            freeExpression(((Parenthesis *) data)->expression);
             break;
         case UNARY:
-            freeExpression(asUnaryExpression(expr)->operand);
+            freeExpression(((UnaryExpression *) data)->operand);
             break;
         case BINARY:
-            freeExpression(asBinaryExpression(expr)->left);
-            freeExpression(asBinaryExpression(expr)->right);
+            freeExpression(((BinaryExpression *) data)->left);
+            freeExpression(((BinaryExpression *) data)->right);
+            break;
+        default:
             break;
     }
-
-    free(expr);
+    return NULL;
 }
 
 /// Forward-declaration for function parseExpression
@@ -221,7 +305,7 @@ Expression *parsePrimaryExpression(
         ++input;
         *end = input;
 
-        return makeExpression(PARENTHESIS, &paren, sizeof(paren));;
+        return makeCompoundExpression(PARENTHESIS, &paren, sizeof(paren));
     }
 
     return NULL;
@@ -241,7 +325,7 @@ Expression *parsePostfixExpression(const char *input, const char **end) {
         unary.op = *input;
         unary.operand = expr;
         *end = input + 1;
-        return makeExpression(UNARY, &unary, sizeof(unary));
+        return makeCompoundExpression(UNARY, &unary, sizeof(unary));
     }
     return expr;
 }
@@ -342,7 +426,8 @@ Expression *parseBinaryExpressionRHS(
         bin.left = lhs;
         bin.op = op;
         bin.right = rhs;
-        lhs = makeExpression(BINARY, &bin, sizeof(bin));
+        lhs = makeCompoundExpression(BINARY, &bin, sizeof(bin));
+        if (lhs == NULL) { return NULL; }
 
         *end = input;
     }
@@ -374,9 +459,15 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
             *end = input;
 
             if (*input == '!') {
+                if (input[1] != '(') { return NULL; }
+
                 Expression *expr = parseExpression(input + 2, &input, form);
                 *end = input;
                 if (expr == NULL) { return NULL; }
+                if (*input != ')') {
+                    freeExpression(expr);
+                    return NULL;
+                }
 
                 /* Skipping ')' */
                 ++input;
@@ -385,9 +476,10 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
                 UnaryExpression unary;
                 unary.op = '!';
                 unary.operand = expr;
-                return makeExpression(UNARY, &unary, sizeof(unary));
+                return makeCompoundExpression(UNARY, &unary, sizeof(unary));
             } else if (isBinaryOperator(*input)) {
                 char op = *input;
+                if (input[1] != '(') { return NULL; }
 
                 Expression *lhs = parseExpression(
                         input + 2, // skipping operator and parenthesis
@@ -396,6 +488,10 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
                 );
                 *end = input;
                 if (lhs == NULL) { return NULL; }
+                if (*input != ',') {
+                    freeExpression(lhs);
+                    return NULL;
+                }
 
                 Expression *rhs = parseExpression(
                         input + 1, // skip the comma
@@ -407,6 +503,11 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
                     freeExpression(lhs);
                     return NULL;
                 }
+                if (*input != ')') {
+                    freeExpression(lhs);
+                    freeExpression(rhs);
+                    return NULL;
+                }
 
                 /* Skipping ')' */
                 ++input;
@@ -416,7 +517,7 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
                 bin.left = lhs;
                 bin.op = op;
                 bin.right = rhs;
-                return makeExpression(BINARY, &bin, sizeof(bin));
+                return makeCompoundExpression(BINARY, &bin, sizeof(bin));
             }
             return parsePrimaryExpression(input, end, form);
         }
@@ -449,13 +550,13 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
                     ++input;
                     *end = input;
 
-                    return makeExpression(UNARY, &unary, sizeof(unary));
+                    return makeCompoundExpression(UNARY, &unary, sizeof(unary));
                 }
 
                 if (*input == '\0' || *input == ')' || *input == ',') {
                     Parenthesis paren;
                     paren.expression = expr;
-                    return makeExpression(PARENTHESIS, &paren, sizeof(paren));
+                    return makeCompoundExpression(PARENTHESIS, &paren, sizeof(paren));
                 }
 
                 freeExpression(expr);
@@ -489,9 +590,10 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
                         ++input;
                         *end = input;
 
-                        return makeExpression(BINARY, &bin, sizeof(bin));
+                        return makeCompoundExpression(BINARY, &bin, sizeof(bin));
                     }
 
+                    freeExpression(expr);
                     freeExpression(rhs);
                     return NULL;
                 }
@@ -508,296 +610,3007 @@ Expression *parseExpression(const char *input, const char **end, Form form) {
 }
 
 /**
- * @param:  x - number to be erected in factorial
- * @return: factorial
+ * @param:  items    - growing array of expressions
+ * @param:  count    - number of expressions in the array
+ * @param:  capacity - number of expressions the array can hold
+ * @param:  item     - expression to be appended
+ * @return: false if there is not enough memory
+ * @brief:  Append an expression to the end of a growing array
  */
-int factorial(int x) {
-    if (x <= 1) { return 1; }
-    int res = 2;
-    for (int i = 3; i <= x; i++) {
-        res *= i;
+bool pushExpression(
+        Expression ***items,
+        size_t *count,
+        size_t *capacity,
+        Expression *item
+) {
+    if (*count == *capacity) {
+        size_t newCapacity = *capacity == 0 ? 16 : *capacity * 2;
+        Expression **newItems = (Expression **) realloc(
+                *items,
+                newCapacity * sizeof(Expression *)
+        );
+        if (newItems == NULL) { return false; }
+        *items = newItems;
+        *capacity = newCapacity;
     }
-    return res;
+    (*items)[(*count)++] = item;
+    return true;
 }
 
-/**
- * @param:  expr    - expression
- * @param:  context - expression context (variable values)
- * @return: Calculate the value of an expression
- */
-int evaluate(Expression *expr, const Context *context) {
-    assert(expr);
+/// Check if a binary operator is associative,
+///     so that a run of it may be regrouped without changing the value
+bool isAssociativeOperator(char op) {
+    return op == '+' || op == '*';
+}
 
+/// Result of a finished node of a traversal
+typedef union WalkResult {
+    /// Value of the node (evaluation)
+    int value;
+    /// Index of the instruction of the node (compilation)
+    long long index;
+    /// Copy of the node (copying and rebalancing)
+    Expression *expr;
+} WalkResult;
+
+/// Node on the stack of a traversal
+typedef struct WalkFrame {
+    /// Node
+    Expression *expr;
+    /// Number of its children that are already finished
+    int finished;
+    /// Results of the finished children
+    WalkResult children[2];
+} WalkFrame;
+
+/// Explicit stack of a traversal in depth.
+///     A long line is parsed by chunks, so an expression may be arbitrarily deep
+///         and is never walked recursively.
+typedef struct Walk {
+    WalkFrame *frames;
+    size_t count;
+    size_t capacity;
+} Walk;
+
+/// Child number index of a node (NULL if there is no such child)
+Expression *getChild(Expression *expr, int index) {
     switch (expr->kind) {
         case LITERAL:
-            return asLiteral(expr)->value;
-        case VARIABLE: {
-            const Variable *var = asVariable(expr);
-            /// Looking for the index of a variable in a string
-            char *location = strchr(context->variablesNames, var->name);
-            assert(location);
+        case VARIABLE:
+            return NULL;
+        case PARENTHESIS:
+            return index == 0 ? asParenthesis(expr)->expression : NULL;
+        case UNARY:
+            return index == 0 ? asUnaryExpression(expr)->operand : NULL;
+        case BINARY:
+            if (index == 0) { return asBinaryExpression(expr)->left; }
+            return index == 1 ? asBinaryExpression(expr)->right : NULL;
+    }
+    return NULL;
+}
+
+/// Enter a node, returns false if there is not enough memory
+bool enterWalk(Walk *walk, Expression *expr) {
+    if (walk->count == walk->capacity) {
+        size_t newCapacity = walk->capacity == 0 ? 16 : walk->capacity * 2;
+        WalkFrame *newFrames = (WalkFrame *) realloc(
+                walk->frames,
+                newCapacity * sizeof(WalkFrame)
+        );
+        if (newFrames == NULL) { return false; }
+        walk->frames = newFrames;
+        walk->capacity = newCapacity;
+    }
 
-            long long index = location - context->variablesNames;
+    WalkFrame frame;
+    frame.expr = expr;
+    frame.finished = 0;
+    walk->frames[walk->count++] = frame;
+    return true;
+}
+
+/// Innermost entered node
+WalkFrame *topWalkFrame(Walk *walk) {
+    assert(walk->count > 0);
+    return &walk->frames[walk->count - 1];
+}
+
+/// Leave the innermost node, its result is given to its parent
+void leaveWalk(Walk *walk, WalkResult result) {
+    --walk->count;
+    if (walk->count > 0) {
+        WalkFrame *parent = topWalkFrame(walk);
+        parent->children[parent->finished++] = result;
+    }
+}
 
-            return context->variablesValues[index];
+/**
+ * @param:  run - run of the same associative operator with already rebalanced operands
+ *                    (it is taken over: its nodes are reused, or released if it cannot be rebalanced)
+ * @param:  op  - associative operator of the run
+ * @return: balanced run, NULL if there is not enough memory
+ * @brief:  Rebalance a maximal run of the same associative operator
+ * @details: Operands of the run are collected from left to right
+ *              with an explicit stack,
+ *                  then adjacent operands are joined pairwise level by level,
+ *                      which gives a tree of depth O(log n) with the same operand order.
+ *          A run of n operands has n - 1 nodes, exactly as many as the joins need,
+ *              so the nodes are reused and nothing is changed until all of them are collected.
+ */
+Expression *rebalanceRun(Expression *run, char op) {
+    Expression **pending = NULL;
+    size_t pendingCount = 0;
+    size_t pendingCapacity = 0;
+
+    Expression **nodes = NULL;
+    size_t nodesCount = 0;
+    size_t nodesCapacity = 0;
+
+    Expression **operands = NULL;
+    size_t operandsCount = 0;
+    size_t operandsCapacity = 0;
+
+    bool failed = !pushExpression(&pending, &pendingCount, &pendingCapacity, run);
+    while (!failed && pendingCount > 0) {
+        Expression *node = pending[--pendingCount];
+
+        if (node->kind == BINARY && asBinaryExpression(node)->op == op) {
+            /// Right goes first so that left is taken out first
+            failed = !pushExpression(&nodes, &nodesCount, &nodesCapacity, node) ||
+                     !pushExpression(&pending, &pendingCount, &pendingCapacity,
+                                     asBinaryExpression(node)->right) ||
+                     !pushExpression(&pending, &pendingCount, &pendingCapacity,
+                                     asBinaryExpression(node)->left);
+            continue;
         }
-        case PARENTHESIS:
-            return evaluate(asParenthesis(expr)->expression, context);
-        case UNARY: {
-            UnaryExpression *unary = asUnaryExpression(expr);
-            int operand = evaluate(unary->operand, context);
-            switch (unary->op) {
-                case '!':
-                    return factorial(operand);
-                default:
-                    assert(false && OPERATOR_EXCEPTION);
+
+        failed = !pushExpression(&operands, &operandsCount, &operandsCapacity, node);
+    }
+    free(pending);
+
+    Expression *result = NULL;
+    if (failed) {
+        /// The run is still as it was
+        freeExpression(run);
+    } else {
+        /// Join adjacent operands until one tree is left
+        size_t used = 0;
+        while (operandsCount > 1) {
+            size_t joined = 0;
+            size_t i = 0;
+            for (; i + 1 < operandsCount; i += 2) {
+                Expression *pair = nodes[used++];
+                asBinaryExpression(pair)->left = operands[i];
+                asBinaryExpression(pair)->right = operands[i + 1];
+                operands[joined++] = pair;
             }
-            break;
-        }
-        case BINARY: {
-            BinaryExpression *binary = asBinaryExpression(expr);
-            int left = evaluate(binary->left, context);
-            int right = evaluate(binary->right, context);
-            switch (binary->op) {
-                case '+':
-                    return left + right;
-                case '-':
-                    return left - right;
-                case '*':
-                    return left * right;
-                case '/':
-                    assert(right != 0);
-                    return left / right;
-                case '%':
-                    return left % right;
-                case '^':
-                    /// Exponentiation
-                    return (int) pow(left, right);
-                default:
-                    assert(false && OPERATOR_EXCEPTION);
+            if (i < operandsCount) {
+                operands[joined++] = operands[i];
             }
+            operandsCount = joined;
         }
-    };
+        result = operands[0];
+    }
+    free(nodes);
+    free(operands);
+    return result;
 }
 
 /**
- * @param: file - output file
- * @param: expr - expression
- * @param: form - record form
- * @brief: Printing an expression in prefix or postfix form
+ * @param:  expr      - expression
+ * @param:  rebalance - whether runs of the same associative operator are rebalanced
+ * @return: copy of the expression, NULL if there is not enough memory
+ * @brief:  Copy an expression node by node, children first
  */
-void printExpression(FILE *file, Expression *expr, Form form) {
-    if (expr == NULL) { return; }
+Expression *copyExpressionTree(Expression *expr, bool rebalance) {
+    if (expr == NULL) { return NULL; }
 
-    assert(form != NATURAL);
+    Walk walk = {0};
+    Expression *copy = NULL;
+    bool failed = !enterWalk(&walk, expr);
+    while (!failed && walk.count > 0) {
+        WalkFrame *frame = topWalkFrame(&walk);
+        Expression *child = getChild(frame->expr, frame->finished);
+        if (child != NULL) {
+            failed = !enterWalk(&walk, child);
+            continue;
+        }
 
-    switch (expr->kind) {
-        case LITERAL:
-            fprintf(file, "%d", asLiteral(expr)->value);
-            break;
-        case VARIABLE:
-            fprintf(file, "%c", asVariable(expr)->name);
-            break;
-        case PARENTHESIS:
-            fprintf(file, "(");
-            printExpression(file, asParenthesis(expr)->expression, form);
-            fprintf(file, ")");
-            break;
-        case UNARY: {
-            UnaryExpression *unary = asUnaryExpression(expr);
-            fprintf(file, form == PREFIX ? "%c(" : "(", unary->op);
-            printExpression(file, unary->operand, form);
-            fprintf(file, form == POSTFIX ? ")%c" : ")", unary->op);
-            break;
+        Expression *node = frame->expr;
+        switch (node->kind) {
+            case LITERAL:
+                copy = makeExpression(LITERAL, asLiteral(node), sizeof(Literal));
+                break;
+            case VARIABLE:
+                copy = makeExpression(VARIABLE, asVariable(node), sizeof(Variable));
+                break;
+            case PARENTHESIS: {
+                Parenthesis paren;
+                paren.expression = frame->children[0].expr;
+                copy = makeCompoundExpression(PARENTHESIS, &paren, sizeof(paren));
+                break;
+            }
+            case UNARY: {
+                UnaryExpression unary;
+                unary.op = asUnaryExpression(node)->op;
+                unary.operand = frame->children[0].expr;
+                copy = makeCompoundExpression(UNARY, &unary, sizeof(unary));
+                break;
+            }
+            case BINARY: {
+                BinaryExpression bin;
+                bin.left = frame->children[0].expr;
+                bin.op = asBinaryExpression(node)->op;
+                bin.right = frame->children[1].expr;
+                copy = makeCompoundExpression(BINARY, &bin, sizeof(bin));
+
+                /// A run is rebalanced at its top node, when all of it is copied
+                bool runGoesOn = walk.count > 1 &&
+                                 walk.frames[walk.count - 2].expr->kind == BINARY &&
+                                 asBinaryExpression(walk.frames[walk.count - 2].expr)->op == bin.op;
+                if (copy != NULL && rebalance && isAssociativeOperator(bin.op) && !runGoesOn) {
+                    copy = rebalanceRun(copy, bin.op);
+                }
+                break;
+            }
         }
-        case BINARY: {
-            BinaryExpression *binary = asBinaryExpression(expr);
-            fprintf(file, form == PREFIX ? "%c(" : "(", binary->op);
-            printExpression(file, binary->left, form);
-            fprintf(file, ",");
-            printExpression(file, binary->right, form);
-            fprintf(file, form == POSTFIX ? ")%c" : ")", binary->op);
+
+        if (copy == NULL) {
+            /// The copies of the children are already released
+            frame->finished = 0;
+            failed = true;
             break;
         }
-    };
+        leaveWalk(&walk, (WalkResult) {.expr = copy});
+    }
+
+    if (failed) {
+        for (size_t i = 0; i < walk.count; ++i) {
+            for (int j = 0; j < walk.frames[i].finished; ++j) {
+                freeExpression(walk.frames[i].children[j].expr);
+            }
+        }
+        copy = NULL;
+    }
+    free(walk.frames);
+    return copy;
 }
 
+/**
+ * @param:  expr - expression
+ * @return: rebalanced copy of the expression, NULL if there is not enough memory
+ * @brief:  Copy an expression, turning runs of the same associative operator
+ *              (1+2+3+...+n, a*b*c*...) into balanced trees.
+ *          The original expression is not modified, so it is still saved as it was loaded.
+ */
+Expression *rebalanceExpression(Expression *expr) {
+    return copyExpressionTree(expr, true);
+}
 
-/// @brief:   Available commands
-typedef enum Command {
-    INVALID,  // Invalid command
+/// What a resumable parser expects next
+typedef enum StreamState {
+    EXPECT_EXPRESSION, // An operand or an opening construct
+    EXPECT_OPEN,       // '(' after a prefix operator
+    AFTER_EXPRESSION,  // Something that follows a finished operand
+    AFTER_CLOSE,       // Postfix form: '!' or nothing after '(' expression ')'
+    EXPECT_OPERATOR    // Postfix form: operator after '(' expression ',' expression ')'
+} StreamState;
+
+/// Construct that is opened but not finished yet
+typedef struct StreamFrame {
+    /// '(' for parentheses and groups, '!' or a binary operator otherwise
+    char symbol;
+    /// Whether the first operand of a binary construct is already read
+    bool second;
+} StreamFrame;
+
+/// Resumable parser that is fed an expression by chunks of any size
+typedef struct StreamParser {
+    /// Form of expression
+    Form form;
+    /// What is expected next
+    StreamState state;
+    /// In natural form: whether '!' may follow the last operand
+    bool bangAllowed;
+    /// Whether the literal being read is not finished yet (it may be split between chunks)
+    bool inLiteral;
+    /// Value of the literal being read
+    int literal;
+    /// Whether the input is already known to be incorrect
+    bool failed;
+    /// Whether only the syntax is checked: nodes are counted, but not allocated
+    bool validateOnly;
+    /// Number of nodes and their bytes so far
+    size_t nodesCount;
+    size_t bytesCount;
+    /// Maximum number of nodes and bytes (0 - unlimited)
+    size_t nodesLimit;
+    size_t bytesLimit;
+    /// Finished subexpressions waiting for their parent
+    ///     (when only validating, just operandsCount is kept)
+    Expression **operands;
+    size_t operandsCount;
+    size_t operandsCapacity;
+    /// Opened constructs
+    StreamFrame *frames;
+    size_t framesCount;
+    size_t framesCapacity;
+} StreamParser;
 
-    PARSE,    // Parsing an expression, takes an expression as an argument
-    LOAD_PRF, // Loading an expression in prefix form
-    LOAD_PST, // Loading an expression in postfix form
-    SAVE_PRF, // Storing an expression in prefix form
-    SAVE_PST, // Storing an expression in postfix form
-    EVALUATE  // Expression evaluation
-} Command;
+/**
+ * @param: parser - parser to be initialized
+ * @param: form   - form of expression that will be fed
+ */
+void initStreamParser(StreamParser *parser, Form form) {
+    assert(parser);
+
+    memset(parser, 0, sizeof(*parser));
+    parser->form = form;
+    parser->state = EXPECT_EXPRESSION;
+}
 
 /**
- * @param:  command - command to be parsed
- * @return: the command given in the input
+ * @param: parser     - initialized parser
+ * @param: nodesLimit - maximum number of nodes (0 - unlimited)
+ * @param: bytesLimit - maximum bytes of nodes (0 - unlimited)
+ * @brief: Make the input incorrect as soon as the tree gets bigger than the limits
  */
-Command parseCommand(const char *command) {
-    if (strcmp(command, "parse") == 0) {
-        return PARSE;
+void limitStreamParser(StreamParser *parser, size_t nodesLimit, size_t bytesLimit) {
+    parser->nodesLimit = nodesLimit;
+    parser->bytesLimit = bytesLimit;
+}
+
+/// Release everything the parser holds
+void freeStreamParser(StreamParser *parser) {
+    for (size_t i = 0; parser->operands != NULL && i < parser->operandsCount; ++i) {
+        freeExpression(parser->operands[i]);
     }
-    if (strcmp(command, "load_prf") == 0) {
-        return LOAD_PRF;
+    free(parser->operands);
+    free(parser->frames);
+    memset(parser, 0, sizeof(*parser));
+}
+
+/// Open a construct, returns false if there is not enough memory
+bool pushStreamFrame(StreamParser *parser, char symbol) {
+    if (parser->framesCount == parser->framesCapacity) {
+        size_t newCapacity = parser->framesCapacity == 0 ? 16 : parser->framesCapacity * 2;
+        StreamFrame *newFrames = (StreamFrame *) realloc(
+                parser->frames,
+                newCapacity * sizeof(StreamFrame)
+        );
+        if (newFrames == NULL) { return false; }
+        parser->frames = newFrames;
+        parser->framesCapacity = newCapacity;
     }
-    if (strcmp(command, "load_pst") == 0) {
-        return LOAD_PST;
+
+    StreamFrame frame;
+    frame.symbol = symbol;
+    frame.second = false;
+    parser->frames[parser->framesCount++] = frame;
+    return true;
+}
+
+/// Innermost opened construct (NULL if there is none)
+StreamFrame *topStreamFrame(StreamParser *parser) {
+    return parser->framesCount > 0 ? &parser->frames[parser->framesCount - 1] : NULL;
+}
+
+/// Account a new node, returns false (the input is incorrect) if it does not fit into the limits
+bool countStreamNode(StreamParser *parser, size_t dataSizeof) {
+    ++parser->nodesCount;
+    parser->bytesCount += sizeof(Expression) + dataSizeof;
+    if ((parser->nodesLimit != 0 && parser->nodesCount > parser->nodesLimit) ||
+        (parser->bytesLimit != 0 && parser->bytesCount > parser->bytesLimit)) {
+        parser->failed = true;
+        return false;
     }
-    if (strcmp(command, "save_prf") == 0) {
-        return SAVE_PRF;
+    return true;
+}
+
+/// Take ownership of a finished operand, the expression is released on failure
+///     (when only validating, expr is NULL and just counted)
+void pushStreamOperand(StreamParser *parser, Expression *expr) {
+    if (parser->validateOnly) {
+        ++parser->operandsCount;
+    } else if (expr == NULL ||
+               !pushExpression(&parser->operands, &parser->operandsCount, &parser->operandsCapacity, expr)) {
+        freeExpression(expr);
+        parser->failed = true;
+        return;
     }
-    if (strcmp(command, "save_pst") == 0) {
-        return SAVE_PST;
+
+    parser->state = AFTER_EXPRESSION;
+    parser->bangAllowed = true;
+}
+
+/// Add a literal or a variable
+void pushStreamLeaf(StreamParser *parser, ExpressionKind kind, void *data, size_t dataSizeof) {
+    if (!countStreamNode(parser, dataSizeof)) { return; }
+
+    pushStreamOperand(parser, parser->validateOnly ? NULL : makeExpression(kind, data, dataSizeof));
+}
+
+/// Wrap the last operand into a parenthesis or a unary expression
+void wrapStreamOperand(StreamParser *parser, char symbol) {
+    assert(parser->operandsCount >= 1);
+
+    if (!countStreamNode(parser, symbol == '(' ? sizeof(Parenthesis) : sizeof(UnaryExpression))) {
+        return;
     }
-    if (strcmp(command, "evaluate") == 0) {
-        return EVALUATE;
+    if (parser->validateOnly) {
+        --parser->operandsCount;
+        pushStreamOperand(parser, NULL);
+        return;
     }
 
-    return INVALID;
+    Expression *operand = parser->operands[--parser->operandsCount];
+    Expression *wrapped = NULL;
+    if (symbol == '(') {
+        Parenthesis paren;
+        paren.expression = operand;
+        wrapped = makeExpression(PARENTHESIS, &paren, sizeof(paren));
+    } else {
+        UnaryExpression unary;
+        unary.op = symbol;
+        unary.operand = operand;
+        wrapped = makeExpression(UNARY, &unary, sizeof(unary));
+    }
+
+    if (wrapped == NULL) {
+        freeExpression(operand);
+        parser->failed = true;
+        return;
+    }
+    pushStreamOperand(parser, wrapped);
 }
 
-/**
- * @param: expr - the "base" class object for the expression
- * @param: form - form of expression
- * @param: out  -  output file
- * @brief: Loading an expression in the specified form and outputting the result to a file
- */
-void loadExpression(Expression **expr, Form form, FILE *out) {
-    assert(expr);
+/// Join the last two operands with a binary operator
+void joinStreamOperands(StreamParser *parser, char op) {
+    assert(parser->operandsCount >= 2);
 
-    // Free memory from previous expression
-    if (*expr) {
-        freeExpression(*expr);
+    if (!countStreamNode(parser, sizeof(BinaryExpression))) { return; }
+    if (parser->validateOnly) {
+        parser->operandsCount -= 2;
+        pushStreamOperand(parser, NULL);
+        return;
     }
 
-    // Expression parsing
-    char *expression = strtok(
-            NULL, // NULL - continue parsing the previous line
-            " "
-    );
-    const char *end = NULL;
-    *expr = parseExpression(expression, &end, form);
-    if (expr == NULL) {
-        fprintf(out,
-                INVALID_EXCEPTION
-        );
-    } else {
-        fprintf(out,
-                SUCCESS
-        );
+    BinaryExpression bin;
+    bin.right = parser->operands[--parser->operandsCount];
+    bin.op = op;
+    bin.left = parser->operands[--parser->operandsCount];
+
+    Expression *joined = makeExpression(BINARY, &bin, sizeof(bin));
+    if (joined == NULL) {
+        freeExpression(bin.left);
+        freeExpression(bin.right);
+        parser->failed = true;
+        return;
     }
+    pushStreamOperand(parser, joined);
 }
 
-/**
- * @param: line - a string read from a file or command line
- * @param: expr - the "base" class object for the expression
- * @param: out  - output file
- * @brief: processing the line itself
- */
-void processLine(char *line, Expression **expr, FILE *out) {
-    assert(expr);
+/// Natural form: join operands of the opened operators that bind tighter than op
+///     (all of them, if op is 0)
+void reduceStreamOperators(StreamParser *parser, char op) {
+    StreamFrame *top = topStreamFrame(parser);
+    while (!parser->failed && top && top->symbol != '(' &&
+           (op == 0 ||
+            precedence(top->symbol) > precedence(op) ||
+            /// ^ - right associative operator
+            (precedence(top->symbol) == precedence(op) && op != '^'))) {
+        --parser->framesCount;
+        joinStreamOperands(parser, top->symbol);
+        top = topStreamFrame(parser);
+    }
+}
 
-//    split string by spaces
-    char *command = strtok(line, " ");
-//    parse the command
-    Command cmd = parseCommand(command);
-    switch (cmd) {
-        case PARSE: {
-            loadExpression(expr, NATURAL, out);
-            return;
+/// Natural form: take one character that is not a part of a literal
+void putNaturalCharacter(StreamParser *parser, char symbol) {
+    if (parser->state == EXPECT_EXPRESSION) {
+        if (isalpha(symbol)) {
+            Variable var;
+            var.name = symbol;
+            pushStreamLeaf(parser, VARIABLE, &var, sizeof(var));
+        } else if (symbol == '(') {
+            parser->failed = !pushStreamFrame(parser, '(');
+        } else {
+            parser->failed = true;
         }
-        case LOAD_PRF: {
-            loadExpression(expr, PREFIX, out);
+        return;
+    }
+
+    if (symbol == '!' && parser->bangAllowed) {
+        wrapStreamOperand(parser, '!');
+        parser->bangAllowed = false;
+    } else if (isBinaryOperator(symbol)) {
+        reduceStreamOperators(parser, symbol);
+        parser->failed = parser->failed || !pushStreamFrame(parser, symbol);
+        parser->state = EXPECT_EXPRESSION;
+    } else if (symbol == ')') {
+        reduceStreamOperators(parser, 0);
+        if (parser->failed || topStreamFrame(parser) == NULL) {
+            parser->failed = true;
             return;
         }
-        case LOAD_PST: {
-            loadExpression(expr, POSTFIX, out);
+        --parser->framesCount;
+        wrapStreamOperand(parser, '(');
+    } else {
+        parser->failed = true;
+    }
+}
+
+/// Prefix form: take one character that is not a part of a literal
+void putPrefixCharacter(StreamParser *parser, char symbol) {
+    switch (parser->state) {
+        case EXPECT_EXPRESSION:
+            if (isalpha(symbol)) {
+                Variable var;
+                var.name = symbol;
+                pushStreamLeaf(parser, VARIABLE, &var, sizeof(var));
+            } else if (symbol == '!' || isBinaryOperator(symbol)) {
+                parser->failed = !pushStreamFrame(parser, symbol);
+                parser->state = EXPECT_OPEN;
+            } else if (symbol == '(') {
+                parser->failed = !pushStreamFrame(parser, '(');
+            } else {
+                parser->failed = true;
+            }
             return;
-        }
-        case SAVE_PRF: {
-            if (expr == NULL) {
-                fprintf(out,
-                        NOT_LOADED_EXCEPTION
-                );
-                return;
+        case EXPECT_OPEN:
+            parser->failed = symbol != '(';
+            parser->state = EXPECT_EXPRESSION;
+            return;
+        case AFTER_EXPRESSION: {
+            StreamFrame *top = topStreamFrame(parser);
+            if (top == NULL) {
+                parser->failed = true;
+            } else if (isBinaryOperator(top->symbol) && !top->second) {
+                parser->failed = symbol != ',';
+                top->second = true;
+                parser->state = EXPECT_EXPRESSION;
+            } else if (symbol != ')') {
+                parser->failed = true;
+            } else {
+                --parser->framesCount;
+                if (isBinaryOperator(top->symbol)) {
+                    joinStreamOperands(parser, top->symbol);
+                } else {
+                    wrapStreamOperand(parser, top->symbol);
+                }
             }
-
-            printExpression(out, *expr, PREFIX);
-            fprintf(out, "\n");
             return;
         }
-        case SAVE_PST: {
-            if (expr == NULL) {
-                fprintf(out,
-                        NOT_LOADED_EXCEPTION
-                );
+        default:
+            parser->failed = true;
+            return;
+    }
+}
+
+/// Postfix form: take one character that is not a part of a literal
+void putPostfixCharacter(StreamParser *parser, char symbol) {
+    switch (parser->state) {
+        case EXPECT_EXPRESSION:
+            if (isalpha(symbol)) {
+                Variable var;
+                var.name = symbol;
+                pushStreamLeaf(parser, VARIABLE, &var, sizeof(var));
+            } else if (symbol == '(') {
+                parser->failed = !pushStreamFrame(parser, '(');
+            } else {
+                parser->failed = true;
+            }
+            return;
+        case AFTER_CLOSE:
+            if (symbol == '!') {
+                wrapStreamOperand(parser, '!');
                 return;
             }
-
-            printExpression(out, *expr, POSTFIX);
-            fprintf(out, "\n");
+            /// '(' expression ')' without '!' is a parenthesis,
+            ///     the character belongs to the enclosing construct
+            wrapStreamOperand(parser, '(');
+            if (!parser->failed) {
+                putPostfixCharacter(parser, symbol);
+            }
             return;
-        }
-        case EVALUATE: {
-            if (expr == NULL) {
-                fprintf(out,
-                        NOT_LOADED_EXCEPTION
-                );
+        case EXPECT_OPERATOR:
+            if (!isBinaryOperator(symbol)) {
+                parser->failed = true;
                 return;
             }
+            joinStreamOperands(parser, symbol);
+            return;
+        case AFTER_EXPRESSION: {
+            StreamFrame *top = topStreamFrame(parser);
+            if (top == NULL) {
+                parser->failed = true;
+            } else if (symbol == ',' && !top->second) {
+                top->second = true;
+                parser->state = EXPECT_EXPRESSION;
+            } else if (symbol == ')') {
+                parser->state = top->second ? EXPECT_OPERATOR : AFTER_CLOSE;
+                --parser->framesCount;
+            } else {
+                parser->failed = true;
+            }
+            return;
+        }
+        default:
+            parser->failed = true;
+            return;
+    }
+}
 
-            Context context;
-            context.variablesNames = (char *) malloc(1);
-            context.variablesNames[0] = '\0';
-            context.variablesValues = (int *) malloc(0);
-
-            char *var = strtok(NULL, " ,");
-            while (var) {
-                char name = var[0];
-                int value = atoi(var + 2);
-
-                size_t varsCount = strlen(context.variablesNames);
-                char *newNames = (char *) realloc(
-                        context.variablesNames,
-                        varsCount + 2
-                );
-                assert(newNames != NULL);
-                context.variablesNames = newNames;
-                context.variablesNames[varsCount] = name;
-                context.variablesNames[varsCount + 1] = '\0';
-
-                int *newValues = (int *) realloc(
-                        context.variablesValues,
-                        (varsCount + 1) * sizeof(int)
-                );
-                assert(newValues != NULL);
-                context.variablesValues = newValues;
-                context.variablesValues[varsCount] = value;
+/// Finish the literal being read, if there is one
+void flushStreamLiteral(StreamParser *parser) {
+    if (!parser->inLiteral) { return; }
 
-                var = strtok(NULL, " ,");
-            }
+    Literal lit;
+    lit.value = parser->literal;
+    parser->inLiteral = false;
+    pushStreamLeaf(parser, LITERAL, &lit, sizeof(lit));
+}
 
-            fprintf(out, "%d\n", evaluate(*expr, &context));
+/**
+ * @param:  parser - parser
+ * @param:  chunk  - next part of the expression text (not NUL-terminated)
+ * @param:  size   - size of the chunk
+ * @return: false if the input is already known to be incorrect
+ * @brief:  Feed the next chunk of an expression.
+ *              The tree is built as the input arrives, so only the tree
+ *                  and the opened constructs are kept in memory, not the text.
+ */
+bool feedStreamParser(StreamParser *parser, const char *chunk, size_t size) {
+    assert(parser);
 
-            free(context.variablesNames);
-            free(context.variablesValues);
-            return;
+    for (size_t i = 0; i < size && !parser->failed; ++i) {
+        char symbol = chunk[i];
+
+        if (isdigit(symbol) && (parser->inLiteral || parser->state == EXPECT_EXPRESSION)) {
+            if (!parser->inLiteral) {
+                parser->inLiteral = true;
+                parser->literal = 0;
+            }
+            parser->literal = parser->literal * 10 + (symbol - '0');
+            continue;
         }
-        case INVALID: {
-            fprintf(out, INVALID_EXCEPTION);
-            return;
+
+        flushStreamLiteral(parser);
+        if (parser->failed) { break; }
+
+        switch (parser->form) {
+            case NATURAL:
+                putNaturalCharacter(parser, symbol);
+                break;
+            case PREFIX:
+                putPrefixCharacter(parser, symbol);
+                break;
+            case POSTFIX:
+                putPostfixCharacter(parser, symbol);
+                break;
         }
-    };
+    }
+    return !parser->failed;
 }
 
-int main(int argc, const char *argv[]) {
-    Expression *expr = NULL;
+/**
+ * @param:  parser - parser that was fed the whole expression
+ * @return: false if the input is incorrect
+ * @brief:  Close what the end of input closes and check that exactly one expression is left
+ */
+bool completeStreamParser(StreamParser *parser) {
+    flushStreamLiteral(parser);
+    if (!parser->failed && parser->state == AFTER_CLOSE) {
+        wrapStreamOperand(parser, '(');
+    }
+    if (!parser->failed && parser->form == NATURAL && parser->state == AFTER_EXPRESSION) {
+        reduceStreamOperators(parser, 0);
+    }
+
+    return !parser->failed &&
+           parser->state == AFTER_EXPRESSION &&
+           parser->framesCount == 0 &&
+           parser->operandsCount == 1;
+}
+
+/**
+ * @param:  parser - parser that was fed the whole expression
+ * @return: expression, NULL if the input is incorrect
+ * @brief:  Finish parsing and release the parser state
+ */
+Expression *finishStreamParser(StreamParser *parser) {
+    assert(parser);
+
+    Expression *expr = NULL;
+    if (completeStreamParser(parser) && !parser->validateOnly) {
+        expr = parser->operands[--parser->operandsCount];
+    }
+    freeStreamParser(parser);
+    return expr;
+}
+
+/**
+ * @param:  input      - expression text
+ * @param:  form       - form of expression
+ * @param:  nodesLimit - maximum number of nodes (0 - unlimited)
+ * @param:  bytesLimit - maximum bytes of nodes (0 - unlimited)
+ * @return: true if the text is a correct expression and its tree fits into the limits
+ * @brief:  Check the syntax and count the nodes without allocating any of them.
+ *              Only one small frame per nesting level is kept,
+ *                  so incorrect or oversized input is rejected before the tree is built.
+ */
+bool validateExpression(const char *input, Form form, size_t nodesLimit, size_t bytesLimit) {
+    if (input == NULL) { return false; }
+
+    StreamParser parser;
+    initStreamParser(&parser, form);
+    parser.validateOnly = true;
+    limitStreamParser(&parser, nodesLimit, bytesLimit);
+
+    feedStreamParser(&parser, input, strlen(input));
+    bool valid = completeStreamParser(&parser);
+    freeStreamParser(&parser);
+    return valid;
+}
+
+/// Number of operations between checks of the clock
+#define EVALUATION_CLOCK_PERIOD 1024
+
+/// Current time (TIME_UTC) in nanoseconds
+long long currentNanoseconds(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (long long) now.tv_sec * 1000000000ll + now.tv_nsec;
+}
+
+/**
+ * @param:  evaluation - limits of the evaluation (NULL - no limits)
+ * @param:  limit      - maximum number of operations (0 - unlimited)
+ * @param:  time       - maximum time in milliseconds (0 - unlimited)
+ * @brief:  Start an evaluation with the given budget
+ */
+void startEvaluation(Evaluation *evaluation, unsigned long long limit, unsigned long long time) {
+    evaluation->operations = 0;
+    evaluation->operationsLimit = limit;
+    evaluation->deadline = time == 0 ? 0 : currentNanoseconds() + (long long) time * 1000000ll;
+    evaluation->error = NO_ERROR;
+}
+
+/// Stop an evaluation with an error (the first error is kept)
+void failEvaluation(Evaluation *evaluation, EvaluationError error) {
+    if (evaluation != NULL && evaluation->error == NO_ERROR) {
+        evaluation->error = error;
+    }
+}
+
+/// Check if an evaluation has already met an error (its values do not matter anymore)
+bool evaluationFailed(const Evaluation *evaluation) {
+    return evaluation != NULL && evaluation->error != NO_ERROR;
+}
+
+/**
+ * @param:  evaluation - limits of the evaluation (NULL - no limits)
+ * @return: false if the evaluation has to stop
+ * @brief:  Account one operation against the budget.
+ *              The clock is checked once per EVALUATION_CLOCK_PERIOD operations.
+ */
+bool spendOperation(Evaluation *evaluation) {
+    if (evaluation == NULL) { return true; }
+    if (evaluationFailed(evaluation)) { return false; }
+
+    ++evaluation->operations;
+    if ((evaluation->operationsLimit != 0 && evaluation->operations > evaluation->operationsLimit) ||
+        (evaluation->deadline != 0 &&
+         evaluation->operations % EVALUATION_CLOCK_PERIOD == 0 &&
+         currentNanoseconds() > evaluation->deadline)) {
+        evaluation->error = BUDGET_ERROR;
+        return false;
+    }
+    return true;
+}
+
+/// Factorials that fit into int
+static const int FACTORIALS[] = {
+        1, 1, 2, 6, 24, 120, 720, 5040, 40320, 362880, 3628800, 39916800, 479001600
+};
+
+/**
+ * @param:  x          - number to be erected in factorial
+ * @param:  evaluation - where to report an overflow
+ * @return: factorial
+ */
+int factorial(int x, Evaluation *evaluation) {
+    if (x <= 1) { return 1; }
+    if ((size_t) x >= sizeof(FACTORIALS) / sizeof(FACTORIALS[0])) {
+        failEvaluation(evaluation, OVERFLOW_ERROR);
+        return 0;
+    }
+    return FACTORIALS[x];
+}
+
+/**
+ * @param:  base       - base
+ * @param:  exponent   - exponent
+ * @param:  evaluation - where to report an overflow
+ * @return: integer part of base^exponent
+ * @brief:  Exponentiation by squaring, stops as soon as the result does not fit into int
+ */
+int power(int base, int exponent, Evaluation *evaluation) {
+    /// Powers of 0, 1 and -1 do not grow
+    if (base == 0) {
+        if (exponent < 0) {
+            failEvaluation(evaluation, OVERFLOW_ERROR);
+            return 0;
+        }
+        return exponent == 0 ? 1 : 0;
+    }
+    if (base == 1) { return 1; }
+    if (base == -1) { return exponent % 2 == 0 ? 1 : -1; }
+    /// |base| >= 2: a fraction between -1 and 1
+    if (exponent < 0) { return 0; }
+
+    long long result = 1;
+    long long factor = base;
+    while (true) {
+        if (exponent & 1) {
+            result *= factor;
+            if (result > INT_MAX || result < INT_MIN) {
+                failEvaluation(evaluation, OVERFLOW_ERROR);
+                return 0;
+            }
+        }
+        exponent >>= 1;
+        if (exponent == 0) { break; }
+
+        factor *= factor;
+        /// The result will be multiplied by at least factor
+        if (factor > -(long long) INT_MIN) {
+            failEvaluation(evaluation, OVERFLOW_ERROR);
+            return 0;
+        }
+    }
+    return (int) result;
+}
+
+/**
+ * @param:  context - expression context (variable values)
+ * @param:  name    - name of variable
+ * @param:  value   - where to put the value of the variable
+ * @return: false if the variable is not set in the context
+ */
+bool findVariable(const Context *context, char name, int *value) {
+    /// Looking for the index of a variable in a string
+    char *location = strchr(context->variablesNames, name);
+    if (location == NULL || name == '\0') { return false; }
+
+    long long index = location - context->variablesNames;
+
+    *value = context->variablesValues[index];
+    return true;
+}
+
+/**
+ * @param:  op         - unary operator
+ * @param:  operand    - value of the operand
+ * @param:  evaluation - where to report an overflow
+ * @return: Calculate the value of a unary expression
+ */
+int applyUnaryOperator(char op, int operand, Evaluation *evaluation) {
+    switch (op) {
+        case '!':
+            return factorial(operand, evaluation);
+        default:
+            assert(false && OPERATOR_EXCEPTION);
+    }
+    return 0;
+}
+
+/**
+ * @param:  op         - binary operator
+ * @param:  left       - value of the left expression
+ * @param:  right      - value of the right expression
+ * @param:  evaluation - where to report an overflow or a division by zero
+ * @return: Calculate the value of a binary expression
+ */
+int applyBinaryOperator(char op, int left, int right, Evaluation *evaluation) {
+    /// Sums and products wrap around (two's complement),
+    ///     so regrouping a run of them never changes the value
+    switch (op) {
+        case '+':
+            return (int) ((unsigned) left + (unsigned) right);
+        case '-':
+            return (int) ((unsigned) left - (unsigned) right);
+        case '*':
+            return (int) ((unsigned) left * (unsigned) right);
+        case '/':
+        case '%':
+            if (right == 0) {
+                failEvaluation(evaluation, DIVISION_ERROR);
+                return 0;
+            }
+            /// INT_MIN / -1 does not fit into int, the remainder is 0
+            if (left == INT_MIN && right == -1) {
+                if (op == '%') { return 0; }
+                failEvaluation(evaluation, OVERFLOW_ERROR);
+                return 0;
+            }
+            return op == '/' ? left / right : left % right;
+        case '^':
+            /// Exponentiation
+            return power(left, right, evaluation);
+        default:
+            assert(false && OPERATOR_EXCEPTION);
+    }
+    return 0;
+}
+
+/**
+ * @param:  expr    - expression
+ * @param:  context - expression context (variable values)
+ * @return: Calculate the value of an expression
+ * @brief:  The nodes are visited with an explicit stack, children first.
+ *              Errors, including a missing variable or not enough memory,
+ *                  are reported in the evaluation of the context.
+ */
+int evaluate(Expression *expr, const Context *context) {
+    assert(expr);
+
+    Walk walk = {0};
+    int result = 0;
+    /// Out of budget: the value does not matter anymore
+    bool failed = !spendOperation(context->evaluation);
+    if (!failed && !enterWalk(&walk, expr)) {
+        failEvaluation(context->evaluation, MEMORY_ERROR);
+        failed = true;
+    }
+    while (!failed && walk.count > 0) {
+        WalkFrame *frame = topWalkFrame(&walk);
+        Expression *child = getChild(frame->expr, frame->finished);
+        if (child != NULL) {
+            if (!spendOperation(context->evaluation)) {
+                failed = true;
+            } else if (!enterWalk(&walk, child)) {
+                failEvaluation(context->evaluation, MEMORY_ERROR);
+                failed = true;
+            }
+            continue;
+        }
+
+        Expression *node = frame->expr;
+        switch (node->kind) {
+            case LITERAL:
+                result = asLiteral(node)->value;
+                break;
+            case VARIABLE:
+                if (!findVariable(context, asVariable(node)->name, &result)) {
+                    failEvaluation(context->evaluation, UNBOUND_ERROR);
+                    failed = true;
+                }
+                break;
+            case PARENTHESIS:
+                result = frame->children[0].value;
+                break;
+            case UNARY:
+                result = applyUnaryOperator(
+                        asUnaryExpression(node)->op,
+                        frame->children[0].value,
+                        context->evaluation
+                );
+                break;
+            case BINARY:
+                result = applyBinaryOperator(
+                        asBinaryExpression(node)->op,
+                        frame->children[0].value,
+                        frame->children[1].value,
+                        context->evaluation
+                );
+                break;
+        }
+        /// The value is not a value (overflow): '/' or '%' could divide by it
+        failed = failed || evaluationFailed(context->evaluation);
+        if (!failed) {
+            leaveWalk(&walk, (WalkResult) {.value = result});
+        }
+    }
+
+    free(walk.frames);
+    return failed ? 0 : result;
+}
+
+/// Growing text
+typedef struct TextBuffer {
+    /// Characters (not NUL-terminated)
+    char *data;
+    size_t size;
+    size_t capacity;
+} TextBuffer;
+
+/// Append characters to a text, returns false if there is not enough memory
+bool appendText(TextBuffer *buffer, const char *text, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t newCapacity = buffer->capacity == 0 ? 64 : buffer->capacity;
+        while (newCapacity < buffer->size + size) {
+            newCapacity *= 2;
+        }
+        char *newData = (char *) realloc(buffer->data, newCapacity);
+        if (newData == NULL) { return false; }
+        buffer->data = newData;
+        buffer->capacity = newCapacity;
+    }
+
+    memcpy(buffer->data + buffer->size, text, size);
+    buffer->size += size;
+    return true;
+}
+
+/// Append what is written before the children of a node (all of a leaf)
+bool renderOpening(TextBuffer *buffer, Expression *expr, Form form) {
+    /// Text of a number or of an operator with a parenthesis
+    char text[16];
+    int length = 0;
+    switch (expr->kind) {
+        case LITERAL:
+            length = snprintf(text, sizeof(text), "%d", asLiteral(expr)->value);
+            break;
+        case VARIABLE:
+            return appendText(buffer, &asVariable(expr)->name, 1);
+        case PARENTHESIS:
+            return appendText(buffer, "(", 1);
+        case UNARY:
+            length = snprintf(text, sizeof(text), form == PREFIX ? "%c(" : "(", asUnaryExpression(expr)->op);
+            break;
+        case BINARY:
+            length = snprintf(text, sizeof(text), form == PREFIX ? "%c(" : "(", asBinaryExpression(expr)->op);
+            break;
+    }
+    return appendText(buffer, text, (size_t) length);
+}
+
+/// Append what is written after the children of a node
+bool renderClosing(TextBuffer *buffer, Expression *expr, Form form) {
+    char text[16];
+    int length = 0;
+    switch (expr->kind) {
+        case LITERAL:
+        case VARIABLE:
+            return true;
+        case PARENTHESIS:
+            return appendText(buffer, ")", 1);
+        case UNARY:
+            length = snprintf(text, sizeof(text), form == POSTFIX ? ")%c" : ")", asUnaryExpression(expr)->op);
+            break;
+        case BINARY:
+            length = snprintf(text, sizeof(text), form == POSTFIX ? ")%c" : ")", asBinaryExpression(expr)->op);
+            break;
+    }
+    return appendText(buffer, text, (size_t) length);
+}
+
+/**
+ * @param:  buffer - text the expression is appended to
+ * @param:  expr   - expression
+ * @param:  form   - record form
+ * @return: false if there is not enough memory
+ * @brief:  Writing an expression in prefix or postfix form
+ */
+bool renderExpression(TextBuffer *buffer, Expression *expr, Form form) {
+    if (expr == NULL) { return true; }
+
+    assert(form != NATURAL);
+
+    Walk walk = {0};
+    bool rendered = enterWalk(&walk, expr) && renderOpening(buffer, expr, form);
+    while (rendered && walk.count > 0) {
+        WalkFrame *frame = topWalkFrame(&walk);
+        Expression *child = getChild(frame->expr, frame->finished);
+        if (child != NULL) {
+            /// Operands of a binary expression are separated by a comma
+            rendered = (frame->finished == 0 || appendText(buffer, ",", 1)) &&
+                       enterWalk(&walk, child) &&
+                       renderOpening(buffer, child, form);
+            continue;
+        }
+
+        rendered = renderClosing(buffer, frame->expr, form);
+        leaveWalk(&walk, (WalkResult) {0});
+    }
+
+    free(walk.frames);
+    return rendered;
+}
+
+/**
+ * @param: file - output file
+ * @param: expr - expression
+ * @param: form - record form
+ * @return: false if there is not enough memory (nothing is output)
+ * @brief: Printing an expression in prefix or postfix form
+ */
+bool printExpression(FILE *file, Expression *expr, Form form) {
+    TextBuffer buffer = {0};
+    bool rendered = renderExpression(&buffer, expr, form);
+    if (rendered) {
+        fwrite(buffer.data, 1, buffer.size, file);
+    }
+    free(buffer.data);
+    return rendered;
+}
+
+/// Instruction of a compiled program
+typedef struct Instruction {
+    /// 'n' - number, 'v' - variable, '!' or a binary operator
+    char op;
+    /// Value of the number, name of the variable or index of the (left) operand
+    int left;
+    /// Index of the right operand
+    int right;
+} Instruction;
+
+/// Straight-line program that evaluates several expressions at once.
+///     Equal subexpressions (within one expression or across several)
+///         are compiled into one instruction, so they are evaluated once.
+typedef struct Program {
+    /// Instructions in the order of evaluation (operands go first)
+    Instruction *instructions;
+    size_t instructionsCount;
+    size_t instructionsCapacity;
+    /// Hash table of instruction indexes + 1 (0 - empty cell)
+    size_t *table;
+    size_t tableCapacity;
+    /// Index of the result instruction of each compiled expression
+    size_t *results;
+    size_t resultsCount;
+} Program;
+
+/// Release the memory of a program
+void freeProgram(Program *program) {
+    if (program == NULL) { return; }
+
+    free(program->instructions);
+    free(program->table);
+    free(program->results);
+    free(program);
+}
+
+/// Hash of an instruction.
+///     Operands are consecutive instruction indexes, so the bits are mixed thoroughly:
+///         otherwise consecutive hashes form one long cluster in the table.
+size_t hashInstruction(Instruction instruction) {
+    uint64_t hash = (unsigned char) instruction.op;
+    hash = (hash << 32 | (uint32_t) instruction.left) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (uint32_t) instruction.right) * 0xBF58476D1CE4E5B9ull;
+    return (size_t) (hash ^ (hash >> 31));
+}
+
+/// Double the hash table of a program, returns false if there is not enough memory
+bool growProgramTable(Program *program) {
+    size_t newCapacity = program->tableCapacity == 0 ? 64 : program->tableCapacity * 2;
+    size_t *newTable = (size_t *) calloc(newCapacity, sizeof(size_t));
+    if (newTable == NULL) { return false; }
+
+    for (size_t i = 0; i < program->instructionsCount; ++i) {
+        size_t cell = hashInstruction(program->instructions[i]) & (newCapacity - 1);
+        while (newTable[cell] != 0) {
+            cell = (cell + 1) & (newCapacity - 1);
+        }
+        newTable[cell] = i + 1;
+    }
+
+    free(program->table);
+    program->table = newTable;
+    program->tableCapacity = newCapacity;
+    return true;
+}
+
+/**
+ * @param:  program     - program
+ * @param:  instruction - instruction to be added
+ * @return: index of an equal instruction if there is one,
+ *              otherwise index of the added instruction, -1 if there is not enough memory
+ */
+long long addInstruction(Program *program, Instruction instruction) {
+    /// Keep the table at most half full
+    if (2 * (program->instructionsCount + 1) > program->tableCapacity &&
+        !growProgramTable(program)) {
+        return -1;
+    }
+
+    size_t cell = hashInstruction(instruction) & (program->tableCapacity - 1);
+    while (program->table[cell] != 0) {
+        Instruction *other = &program->instructions[program->table[cell] - 1];
+        if (other->op == instruction.op &&
+            other->left == instruction.left &&
+            other->right == instruction.right) {
+            return (long long) program->table[cell] - 1;
+        }
+        cell = (cell + 1) & (program->tableCapacity - 1);
+    }
+
+    if (program->instructionsCount == program->instructionsCapacity) {
+        size_t newCapacity = program->instructionsCapacity == 0 ? 64 : program->instructionsCapacity * 2;
+        Instruction *newInstructions = (Instruction *) realloc(
+                program->instructions,
+                newCapacity * sizeof(Instruction)
+        );
+        if (newInstructions == NULL) { return -1; }
+        program->instructions = newInstructions;
+        program->instructionsCapacity = newCapacity;
+    }
+
+    program->instructions[program->instructionsCount] = instruction;
+    program->table[cell] = ++program->instructionsCount;
+    return (long long) program->instructionsCount - 1;
+}
+
+/**
+ * @param:  program - program
+ * @param:  expr    - expression to be compiled
+ * @return: index of the instruction with the value of the expression,
+ *              -1 if there is not enough memory
+ */
+long long compileExpression(Program *program, Expression *expr) {
+    assert(expr);
+
+    Walk walk = {0};
+    long long result = enterWalk(&walk, expr) ? 0 : -1;
+    while (result >= 0 && walk.count > 0) {
+        WalkFrame *frame = topWalkFrame(&walk);
+        Expression *child = getChild(frame->expr, frame->finished);
+        if (child != NULL) {
+            if (!enterWalk(&walk, child)) { result = -1; }
+            continue;
+        }
+
+        Expression *node = frame->expr;
+        Instruction instruction;
+        instruction.right = 0;
+        switch (node->kind) {
+            case LITERAL:
+                instruction.op = 'n';
+                instruction.left = asLiteral(node)->value;
+                break;
+            case VARIABLE:
+                instruction.op = 'v';
+                instruction.left = asVariable(node)->name;
+                break;
+            case PARENTHESIS:
+                break;
+            case UNARY:
+                instruction.op = asUnaryExpression(node)->op;
+                instruction.left = (int) frame->children[0].index;
+                break;
+            case BINARY: {
+                long long left = frame->children[0].index;
+                long long right = frame->children[1].index;
+
+                /// a+b and b+a (a*b and b*a) are the same instruction
+                char op = asBinaryExpression(node)->op;
+                if ((op == '+' || op == '*') && right < left) {
+                    long long swap = left;
+                    left = right;
+                    right = swap;
+                }
+
+                instruction.op = op;
+                instruction.left = (int) left;
+                instruction.right = (int) right;
+                break;
+            }
+        }
+
+        /// Parentheses do not change the value
+        result = node->kind == PARENTHESIS
+                 ? frame->children[0].index
+                 : addInstruction(program, instruction);
+        if (result >= 0) {
+            leaveWalk(&walk, (WalkResult) {.index = result});
+        }
+    }
+
+    free(walk.frames);
+    return result;
+}
+
+/**
+ * @param:  expressions - expressions to be compiled
+ * @param:  count       - number of expressions
+ * @return: program that evaluates all the expressions, NULL if there is not enough memory
+ */
+Program *compileProgram(Expression **expressions, size_t count) {
+    Program *program = (Program *) calloc(1, sizeof(Program));
+    if (program == NULL) { return NULL; }
+
+    program->results = (size_t *) malloc((count > 0 ? count : 1) * sizeof(size_t));
+    if (program->results == NULL) {
+        freeProgram(program);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        long long result = compileExpression(program, expressions[i]);
+        if (result < 0) {
+            freeProgram(program);
+            return NULL;
+        }
+        program->results[program->resultsCount++] = (size_t) result;
+    }
+    return program;
+}
+
+/**
+ * @param:  program - program
+ * @param:  context - variable values
+ * @param:  values  - where to put the values of all instructions (instructionsCount of them)
+ * @param:  errors  - where to put the error of each instruction (NO_ERROR if its value is calculated)
+ * @brief:  Evaluate every instruction of a program once, in a single pass.
+ *              An overflow is passed on only to the instructions that use the overflowed value,
+ *                  running out of budget leaves all the remaining instructions without values.
+ *              A division by zero and a variable missing from the context are passed on the same way as an overflow.
+ */
+void runProgram(const Program *program, const Context *context, int *values, EvaluationError *errors) {
+    for (size_t i = 0; i < program->instructionsCount; ++i) {
+        const Instruction *instruction = &program->instructions[i];
+        errors[i] = NO_ERROR;
+        values[i] = 0;
+
+        if (!spendOperation(context->evaluation)) {
+            errors[i] = BUDGET_ERROR;
+            continue;
+        }
+
+        /// Errors of this instruction only, the budget is kept in the context
+        Evaluation evaluation = {0};
+        switch (instruction->op) {
+            case 'n':
+                values[i] = instruction->left;
+                break;
+            case 'v':
+                if (!findVariable(context, (char) instruction->left, &values[i])) {
+                    errors[i] = UNBOUND_ERROR;
+                }
+                break;
+            case '!':
+                if (errors[instruction->left] != NO_ERROR) {
+                    errors[i] = errors[instruction->left];
+                    break;
+                }
+                values[i] = applyUnaryOperator(instruction->op, values[instruction->left], &evaluation);
+                errors[i] = evaluation.error;
+                break;
+            default:
+                if (errors[instruction->left] != NO_ERROR || errors[instruction->right] != NO_ERROR) {
+                    errors[i] = errors[instruction->left] != NO_ERROR
+                                ? errors[instruction->left]
+                                : errors[instruction->right];
+                    break;
+                }
+                values[i] = applyBinaryOperator(
+                        instruction->op,
+                        values[instruction->left],
+                        values[instruction->right],
+                        &evaluation
+                );
+                errors[i] = evaluation.error;
+                break;
+        }
+    }
+}
+
+/**
+ * @param:  expr - expression
+ * @return: copy of the expression, NULL if there is not enough memory
+ */
+Expression *copyExpression(Expression *expr) {
+    return copyExpressionTree(expr, false);
+}
+
+/// Number of bits covered by one entry of a rank directory
+#define PACKED_BLOCK_BITS 512
+/// Number of 3-bit codes in one 64-bit word
+#define PACKED_CODES_PER_WORD 21
+
+/// Growing bit vector
+typedef struct PackedBits {
+    /// Bits, 64 per word
+    uint64_t *words;
+    size_t bitsCount;
+    size_t wordsCapacity;
+    /// Number of ones
+    size_t onesCount;
+    /// Rank directory: number of ones before each block of PACKED_BLOCK_BITS bits
+    ///     (only for vectors searched with select)
+    size_t *blockRanks;
+    size_t blocksCount;
+    size_t blocksCapacity;
+} PackedBits;
+
+/// Read-only succinct store of many expressions.
+///     An expression takes about 2 bits of shape, 3 bits of code and 1 bit of boundary per node
+///         plus 1-5 bytes (and as many bits of boundary) per literal or variable.
+typedef struct PackedStore {
+    /// Shape of the trees as balanced parentheses in preorder:
+    ///     1 - a node is opened, 0 - the node is closed.
+    ///         Expressions are appended whole and every node takes exactly one 1 and one 0,
+    ///             so the node number n of an expression root is opened at position 2n.
+    PackedBits shape;
+    /// 3-bit codes of the nodes in preorder:
+    ///     leaf - 0 literal, 1 variable;
+    ///     otherwise - 0..5 binary operator (in "+-*/%^" order), 6 '!', 7 parenthesis
+    uint64_t *codes;
+    size_t nodesCount;
+    size_t codesCapacity;
+    /// One bit per node, 1 - the node is the root of an expression
+    PackedBits roots;
+    /// Values of literals and names of variables in preorder, as varints
+    unsigned char *literals;
+    size_t literalsSize;
+    size_t literalsCapacity;
+    /// One bit per byte of the literal stream, 1 - the first byte of an expression
+    ///     (every expression has at least one leaf)
+    PackedBits literalStarts;
+    /// Number of expressions
+    size_t expressionsCount;
+} PackedStore;
+
+/// Binary operators in the order of their codes
+#define PACKED_BINARY_OPERATORS "+-*/%^"
+#define PACKED_UNARY_CODE       6
+#define PACKED_PARENTHESIS_CODE 7
+
+/// Release the memory of a bit vector
+void freePackedBits(PackedBits *bits) {
+    free(bits->words);
+    free(bits->blockRanks);
+    memset(bits, 0, sizeof(*bits));
+}
+
+/// Release the memory of a store
+void freePackedStore(PackedStore *store) {
+    freePackedBits(&store->shape);
+    freePackedBits(&store->roots);
+    freePackedBits(&store->literalStarts);
+    free(store->codes);
+    free(store->literals);
+    memset(store, 0, sizeof(*store));
+}
+
+/**
+ * @param:  items     - growing array
+ * @param:  capacity  - number of items the array can hold
+ * @param:  needed    - number of items the array must hold
+ * @param:  itemSize  - size of one item
+ * @return: false if there is not enough memory
+ */
+bool reserveItems(void **items, size_t *capacity, size_t needed, size_t itemSize) {
+    if (needed <= *capacity) { return true; }
+
+    size_t newCapacity = *capacity == 0 ? 64 : *capacity;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+    void *newItems = realloc(*items, newCapacity * itemSize);
+    if (newItems == NULL) { return false; }
+
+    /// Words are filled with bits, so they have to start zeroed
+    memset((char *) newItems + *capacity * itemSize, 0, (newCapacity - *capacity) * itemSize);
+    *items = newItems;
+    *capacity = newCapacity;
+    return true;
+}
+
+/// Number of ones in a word
+int countOnes(uint64_t word) {
+    word = word - ((word >> 1) & 0x5555555555555555ull);
+    word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (int) ((word * 0x0101010101010101ull) >> 56);
+}
+
+/// Bit of a vector at the position
+bool getBit(const PackedBits *bits, size_t position) {
+    return (bits->words[position / 64] >> (position % 64)) & 1;
+}
+
+/// Append a bit to a vector, returns false if there is not enough memory
+bool appendBit(PackedBits *bits, bool bit) {
+    if (!reserveItems((void **) &bits->words, &bits->wordsCapacity,
+                      bits->bitsCount / 64 + 1, sizeof(uint64_t))) {
+        return false;
+    }
+
+    if (bit) {
+        bits->words[bits->bitsCount / 64] |= 1ull << (bits->bitsCount % 64);
+        ++bits->onesCount;
+    }
+    ++bits->bitsCount;
+    return true;
+}
+
+/// Append a bit to a vector searched with select, returns false if there is not enough memory
+bool appendIndexedBit(PackedBits *bits, bool bit) {
+    if (bits->bitsCount % PACKED_BLOCK_BITS == 0) {
+        if (!reserveItems((void **) &bits->blockRanks, &bits->blocksCapacity,
+                          bits->blocksCount + 1, sizeof(size_t))) {
+            return false;
+        }
+        bits->blockRanks[bits->blocksCount++] = bits->onesCount;
+    }
+    return appendBit(bits, bit);
+}
+
+/**
+ * @param: bits  - vector
+ * @param: saved - the vector as it was before
+ * @brief: Forget the bits appended after saved, words past the end have to be zeroed again
+ */
+void truncateBits(PackedBits *bits, const PackedBits *saved) {
+    for (size_t i = saved->bitsCount; i < bits->bitsCount; ++i) {
+        bits->words[i / 64] &= ~(1ull << (i % 64));
+    }
+    bits->bitsCount = saved->bitsCount;
+    bits->onesCount = saved->onesCount;
+    bits->blocksCount = saved->blocksCount;
+}
+
+/**
+ * @param:  bits - vector searched with select
+ * @param:  rank - number of a one in the vector (from 0)
+ * @return: position of the one
+ * @brief:  select: binary search in the rank directory, then popcount of words
+ */
+size_t selectBit(const PackedBits *bits, size_t rank) {
+    assert(rank < bits->onesCount);
+
+    /// The last block that starts with at most rank ones before it
+    size_t low = 0;
+    size_t high = bits->blocksCount;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (bits->blockRanks[middle] <= rank) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    size_t word = low * PACKED_BLOCK_BITS / 64;
+    size_t left = rank - bits->blockRanks[low];
+    while (true) {
+        int ones = countOnes(bits->words[word]);
+        if ((size_t) ones > left) { break; }
+        left -= ones;
+        ++word;
+    }
+
+    uint64_t value = bits->words[word];
+    for (int bit = 0;; ++bit) {
+        if ((value >> bit) & 1) {
+            if (left == 0) { return word * 64 + bit; }
+            --left;
+        }
+    }
+}
+
+/// 3-bit code of the node
+int getNodeCode(const PackedStore *store, size_t node) {
+    return (int) ((store->codes[node / PACKED_CODES_PER_WORD] >> (3 * (node % PACKED_CODES_PER_WORD))) & 7);
+}
+
+/// Open a node with the code (root - the first node of an expression),
+///     returns false if there is not enough memory
+bool appendNode(PackedStore *store, int code, bool root) {
+    if (!appendBit(&store->shape, true) ||
+        !appendIndexedBit(&store->roots, root) ||
+        !reserveItems((void **) &store->codes, &store->codesCapacity,
+                      store->nodesCount / PACKED_CODES_PER_WORD + 1, sizeof(uint64_t))) {
+        return false;
+    }
+
+    store->codes[store->nodesCount / PACKED_CODES_PER_WORD] |=
+            (uint64_t) code << (3 * (store->nodesCount % PACKED_CODES_PER_WORD));
+    ++store->nodesCount;
+    return true;
+}
+
+/// Append a number to the literal stream (7 bits per byte, the high bit - "more bytes follow"),
+///     first - the first number of an expression
+bool appendVarint(PackedStore *store, unsigned value, bool first) {
+    do {
+        if (!reserveItems((void **) &store->literals, &store->literalsCapacity,
+                          store->literalsSize + 1, 1) ||
+            !appendIndexedBit(&store->literalStarts, first)) {
+            return false;
+        }
+        store->literals[store->literalsSize++] = (unsigned char) ((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+        value >>= 7;
+        first = false;
+    } while (value != 0);
+    return true;
+}
+
+/// Read a number from the literal stream and move the cursor past it
+unsigned readVarint(const PackedStore *store, size_t *cursor) {
+    unsigned value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = store->literals[(*cursor)++];
+        value |= (unsigned) (byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+/**
+ * @param:  store        - store
+ * @param:  node         - node to be appended (its children are appended after it)
+ * @param:  root         - whether the node is the root of its expression
+ * @param:  firstLiteral - whether a literal of the node is the first one of its expression
+ * @return: false if there is not enough memory
+ * @brief:  Append the code of a node, a leaf also gets its literal and is closed at once
+ */
+bool appendExpressionNode(PackedStore *store, Expression *node, bool root, bool firstLiteral) {
+    switch (node->kind) {
+        case LITERAL:
+            return appendNode(store, 0, root) &&
+                   appendVarint(store, (unsigned) asLiteral(node)->value, firstLiteral) &&
+                   appendBit(&store->shape, false);
+        case VARIABLE:
+            return appendNode(store, 1, root) &&
+                   appendVarint(store, (unsigned char) asVariable(node)->name, firstLiteral) &&
+                   appendBit(&store->shape, false);
+        case PARENTHESIS:
+            return appendNode(store, PACKED_PARENTHESIS_CODE, root);
+        case UNARY:
+            return appendNode(store, PACKED_UNARY_CODE, root);
+        case BINARY: {
+            char op = asBinaryExpression(node)->op;
+            return appendNode(store, (int) (strchr(PACKED_BINARY_OPERATORS, op) - PACKED_BINARY_OPERATORS), root);
+        }
+    }
+    return false;
+}
+
+/**
+ * @param:  store - store
+ * @param:  expr  - expression to be appended
+ * @return: false if there is not enough memory
+ * @brief:  Append the nodes of an expression in preorder,
+ *              an inner node is closed when the walk leaves it
+ */
+bool packExpressionNodes(PackedStore *store, Expression *expr) {
+    size_t firstLiteral = store->literalsSize;
+
+    Walk walk = {0};
+    bool failed = !appendExpressionNode(store, expr, true, true) || !enterWalk(&walk, expr);
+    while (!failed && walk.count > 0) {
+        WalkFrame *frame = topWalkFrame(&walk);
+        Expression *child = getChild(frame->expr, frame->finished);
+        if (child != NULL) {
+            failed = !appendExpressionNode(store, child, false, store->literalsSize == firstLiteral) ||
+                     !enterWalk(&walk, child);
+            continue;
+        }
+
+        if (frame->expr->kind != LITERAL && frame->expr->kind != VARIABLE) {
+            failed = !appendBit(&store->shape, false);
+        }
+        leaveWalk(&walk, (WalkResult) {0});
+    }
+    free(walk.frames);
+    return !failed;
+}
+
+/**
+ * @param:  store - store
+ * @param:  expr  - expression to be packed
+ * @param:  index - where to put the index of the packed expression
+ * @return: false if there is not enough memory (the store is left as it was)
+ */
+bool packExpression(PackedStore *store, Expression *expr, size_t *index) {
+    assert(expr);
+
+    PackedStore saved = *store;
+    if (!packExpressionNodes(store, expr)) {
+        /// Forget the partially packed expression, words past the end have to be zeroed again
+        truncateBits(&store->shape, &saved.shape);
+        truncateBits(&store->roots, &saved.roots);
+        truncateBits(&store->literalStarts, &saved.literalStarts);
+        for (size_t i = saved.nodesCount; i < store->nodesCount; ++i) {
+            store->codes[i / PACKED_CODES_PER_WORD] &= ~(7ull << (3 * (i % PACKED_CODES_PER_WORD)));
+        }
+        store->nodesCount = saved.nodesCount;
+        store->literalsSize = saved.literalsSize;
+        return false;
+    }
+
+    *index = store->expressionsCount++;
+    return true;
+}
+
+/// Cursor of a traversal over a packed expression
+typedef struct PackedCursor {
+    /// Position in the shape
+    size_t position;
+    /// Number of the next node to be opened
+    size_t node;
+    /// Position in the literal stream
+    size_t literal;
+} PackedCursor;
+
+/// Put a cursor at the root of a packed expression
+PackedCursor startPackedCursor(const PackedStore *store, size_t index) {
+    assert(index < store->expressionsCount);
+
+    PackedCursor cursor;
+    cursor.node = selectBit(&store->roots, index);
+    cursor.position = 2 * cursor.node;
+    cursor.literal = selectBit(&store->literalStarts, index);
+    return cursor;
+}
+
+/// Growing stack of ints used by traversals of packed expressions
+typedef struct IntStack {
+    int *items;
+    size_t count;
+    size_t capacity;
+} IntStack;
+
+/// Push a value onto a stack, returns false if there is not enough memory
+bool pushInt(IntStack *stack, int value) {
+    if (!reserveItems((void **) &stack->items, &stack->capacity, stack->count + 1, sizeof(int))) {
+        return false;
+    }
+    stack->items[stack->count++] = value;
+    return true;
+}
+
+/**
+ * @param:  store   - store
+ * @param:  index   - index of the expression
+ * @param:  context - expression context (variable values)
+ * @param:  result  - where to put the value of the expression
+ * @return: false if a variable is not set in the context or there is not enough memory
+ *              (overflows and running out of budget are reported in the evaluation of the context)
+ * @brief:  Calculate the value of a packed expression without unpacking it.
+ *              The shape is scanned left to right: a leaf pushes its value,
+ *                  closing an inner node applies its operator to the values of its children.
+ */
+bool evaluatePacked(const PackedStore *store, size_t index, const Context *context, int *result) {
+    PackedCursor cursor = startPackedCursor(store, index);
+
+    IntStack values = {0};
+    /// Codes of the opened inner nodes
+    IntStack opened = {0};
+    bool completed = true;
+    do {
+        if (!getBit(&store->shape, cursor.position)) {
+            /// An inner node is closed, all its children are evaluated
+            ///     (unless the evaluation failed, then they are not values to apply the operator to)
+            if (evaluationFailed(context->evaluation)) { break; }
+            int code = opened.items[--opened.count];
+            if (code == PACKED_UNARY_CODE) {
+                values.items[values.count - 1] = applyUnaryOperator(
+                        '!',
+                        values.items[values.count - 1],
+                        context->evaluation
+                );
+            } else if (code != PACKED_PARENTHESIS_CODE) {
+                int right = values.items[--values.count];
+                int left = values.items[values.count - 1];
+                values.items[values.count - 1] = applyBinaryOperator(
+                        PACKED_BINARY_OPERATORS[code],
+                        left,
+                        right,
+                        context->evaluation
+                );
+            }
+            ++cursor.position;
+            continue;
+        }
+
+        /// Out of budget: the value does not matter anymore
+        if (!spendOperation(context->evaluation)) { break; }
+
+        int code = getNodeCode(store, cursor.node++);
+        if (getBit(&store->shape, cursor.position + 1)) {
+            if (!pushInt(&opened, code)) {
+                completed = false;
+                break;
+            }
+            ++cursor.position;
+            continue;
+        }
+
+        /// Leaf: "10" in the shape
+        unsigned literal = readVarint(store, &cursor.literal);
+        int value = (int) literal;
+        if ((code == 1 && !findVariable(context, (char) literal, &value)) || !pushInt(&values, value)) {
+            completed = false;
+            break;
+        }
+        cursor.position += 2;
+    } while (opened.count > 0);
+
+    if (completed) {
+        *result = values.count > 0 ? values.items[0] : 0;
+    }
+    free(values.items);
+    free(opened.items);
+    return completed;
+}
+
+/**
+ * @param:  buffer - text to append to
+ * @param:  store  - store
+ * @param:  index  - index of the expression
+ * @param:  form   - record form
+ * @return: false if there is not enough memory
+ * @brief:  Render a packed expression in prefix or postfix form without unpacking it
+ */
+bool renderPacked(TextBuffer *buffer, const PackedStore *store, size_t index, Form form) {
+    assert(form != NATURAL);
+
+    PackedCursor cursor = startPackedCursor(store, index);
+
+    /// Codes of the opened inner nodes and the number of their finished children
+    IntStack opened = {0};
+    IntStack finished = {0};
+    /// Text of a number or of an operator with a parenthesis
+    char text[16];
+    bool rendered = true;
+    do {
+        int length = 0;
+        if (!getBit(&store->shape, cursor.position)) {
+            int code = opened.items[--opened.count];
+            --finished.count;
+            if (code == PACKED_PARENTHESIS_CODE) {
+                length = sprintf(text, ")");
+            } else {
+                char op = code == PACKED_UNARY_CODE ? '!' : PACKED_BINARY_OPERATORS[code];
+                length = sprintf(text, form == POSTFIX ? ")%c" : ")", op);
+            }
+            ++cursor.position;
+        } else {
+            int code = getNodeCode(store, cursor.node++);
+            if (getBit(&store->shape, cursor.position + 1)) {
+                if (code == PACKED_PARENTHESIS_CODE) {
+                    length = sprintf(text, "(");
+                } else {
+                    char op = code == PACKED_UNARY_CODE ? '!' : PACKED_BINARY_OPERATORS[code];
+                    length = sprintf(text, form == PREFIX ? "%c(" : "(", op);
+                }
+                if (!appendText(buffer, text, length) || !pushInt(&opened, code) || !pushInt(&finished, 0)) {
+                    rendered = false;
+                    break;
+                }
+                ++cursor.position;
+                continue;
+            }
+
+            unsigned literal = readVarint(store, &cursor.literal);
+            if (code == 0) {
+                length = sprintf(text, "%d", (int) literal);
+            } else {
+                length = sprintf(text, "%c", (char) literal);
+            }
+            cursor.position += 2;
+        }
+
+        /// A child is finished: the first child of a binary expression is followed by a comma
+        if (opened.count > 0) {
+            int parent = opened.items[opened.count - 1];
+            if (++finished.items[finished.count - 1] == 1 &&
+                parent != PACKED_UNARY_CODE && parent != PACKED_PARENTHESIS_CODE) {
+                text[length++] = ',';
+            }
+        }
+        if (!appendText(buffer, text, length)) {
+            rendered = false;
+            break;
+        }
+    } while (opened.count > 0);
+
+    free(opened.items);
+    free(finished.items);
+    return rendered;
+}
+
+/**
+ * @param:  file  - output file
+ * @param:  store - store
+ * @param:  index - index of the expression
+ * @param:  form  - record form
+ * @return: false if there is not enough memory (nothing is output)
+ * @brief:  Printing a packed expression in prefix or postfix form without unpacking it
+ */
+bool printPacked(FILE *file, const PackedStore *store, size_t index, Form form) {
+    TextBuffer buffer = {0};
+    bool rendered = renderPacked(&buffer, store, index, form);
+    if (rendered) {
+        fwrite(buffer.data, 1, buffer.size, file);
+    }
+    free(buffer.data);
+    return rendered;
+}
+
+
+/// @brief:   Available commands
+typedef enum Command {
+    INVALID,  // Invalid command
+
+    PARSE,    // Parsing an expression, takes an expression as an argument
+    LOAD_PRF, // Loading an expression in prefix form
+    LOAD_PST, // Loading an expression in postfix form
+    SAVE_PRF, // Storing an expression in prefix form
+    SAVE_PST, // Storing an expression in postfix form
+    EVALUATE, // Expression evaluation
+    REBALANCE, // Turning rebalancing of associative operator runs on or off
+    STORE,    // Storing the loaded expression in a named slot
+    EVALUATE_ALL, // Evaluation of all stored expressions at once
+    PACK,     // Storing the loaded expression in the succinct store
+    EVALUATE_PACKED, // Evaluation of a packed expression
+    SAVE_PACKED_PRF, // Storing a packed expression in prefix form
+    SAVE_PACKED_PST, // Storing a packed expression in postfix form
+    EVAL_BUDGET,     // Setting the operation and time budget of evaluations
+    EVAL_CACHE,      // Setting the size of the evaluation result cache
+    EVAL_CACHE_STATS, // Output of the cache hit and miss counters
+    LOAD_BUDGET      // Setting the maximum size of loaded expressions
+} Command;
+
+/**
+ * @param:  command - command to be parsed
+ * @return: the command given in the input
+ */
+Command parseCommand(const char *command) {
+    if (strcmp(command, "parse") == 0) {
+        return PARSE;
+    }
+    if (strcmp(command, "load_prf") == 0) {
+        return LOAD_PRF;
+    }
+    if (strcmp(command, "load_pst") == 0) {
+        return LOAD_PST;
+    }
+    if (strcmp(command, "save_prf") == 0) {
+        return SAVE_PRF;
+    }
+    if (strcmp(command, "save_pst") == 0) {
+        return SAVE_PST;
+    }
+    if (strcmp(command, "evaluate") == 0) {
+        return EVALUATE;
+    }
+    if (strcmp(command, "rebalance") == 0) {
+        return REBALANCE;
+    }
+    if (strcmp(command, "store") == 0) {
+        return STORE;
+    }
+    if (strcmp(command, "evaluate_all") == 0) {
+        return EVALUATE_ALL;
+    }
+    if (strcmp(command, "pack") == 0) {
+        return PACK;
+    }
+    if (strcmp(command, "evaluate_packed") == 0) {
+        return EVALUATE_PACKED;
+    }
+    if (strcmp(command, "save_packed_prf") == 0) {
+        return SAVE_PACKED_PRF;
+    }
+    if (strcmp(command, "save_packed_pst") == 0) {
+        return SAVE_PACKED_PST;
+    }
+    if (strcmp(command, "eval_budget") == 0) {
+        return EVAL_BUDGET;
+    }
+    if (strcmp(command, "eval_cache") == 0) {
+        return EVAL_CACHE;
+    }
+    if (strcmp(command, "eval_cache_stats") == 0) {
+        return EVAL_CACHE_STATS;
+    }
+    if (strcmp(command, "load_budget") == 0) {
+        return LOAD_BUDGET;
+    }
+
+    return INVALID;
+}
+
+/**
+ * @param:  expr - expression
+ * @param:  used - marks of the variables that occur in the expression
+ * @return: false if there is not enough memory
+ * @brief:  Mark the variables of an expression
+ */
+bool markVariables(Expression *expr, bool used[UCHAR_MAX + 1]) {
+    Walk walk = {0};
+    bool failed = !enterWalk(&walk, expr);
+    while (!failed && walk.count > 0) {
+        WalkFrame *frame = topWalkFrame(&walk);
+        Expression *child = getChild(frame->expr, frame->finished);
+        if (child != NULL) {
+            failed = !enterWalk(&walk, child);
+            continue;
+        }
+
+        if (frame->expr->kind == VARIABLE) {
+            used[(unsigned char) asVariable(frame->expr)->name] = true;
+        }
+        leaveWalk(&walk, (WalkResult) {0});
+    }
+    free(walk.frames);
+    return !failed;
+}
+
+/// Marks the end of a list in a result cache
+#define CACHE_NONE SIZE_MAX
+
+/// Cached result of an evaluation
+typedef struct CacheEntry {
+    /// Hash of the values of the used variables
+    uint64_t hash;
+    /// Value of the expression
+    int result;
+    /// Next entry with the same bucket
+    size_t chain;
+    /// Neighbours in the order of use (previous - used more recently)
+    size_t previous;
+    size_t next;
+} CacheEntry;
+
+/// Bounded cache of evaluation results with LRU eviction
+typedef struct ResultCache {
+    /// Maximum number of entries (0 - the cache is off)
+    size_t capacity;
+    /// Entries
+    CacheEntry *entries;
+    size_t count;
+    /// Values of the used variables of each entry (keyLength for each)
+    int *keys;
+    size_t keyLength;
+    /// Number of values of each entry the keys have room for
+    size_t keyCapacity;
+    /// Heads of the hash chains (a power of two of them)
+    size_t *buckets;
+    size_t bucketsCount;
+    /// Generation of each head: a head of an older generation is an empty chain
+    unsigned long long *bucketGenerations;
+    /// Incremented to drop all entries without touching the buckets
+    unsigned long long generation;
+    /// Whether the entries belong to the loaded expression (its key is known and fits)
+    bool keyed;
+    /// Most and least recently used entries
+    size_t newest;
+    size_t oldest;
+    /// Number of lookups that found (did not find) a result
+    unsigned long long hits;
+    unsigned long long misses;
+} ResultCache;
+
+/// Maximum number of entries of a cache: with up to UCHAR_MAX keys per entry
+///     and twice as many buckets as entries, the sizes of its arrays still fit into size_t
+#define CACHE_MAX_ENTRIES \
+    (SIZE_MAX / 2 / ((UCHAR_MAX + 1) * sizeof(int) + sizeof(CacheEntry) + \
+                     2 * (sizeof(size_t) + sizeof(unsigned long long))))
+
+/// Release the memory of a cache, the capacity and the counters are kept
+void freeResultCache(ResultCache *cache) {
+    free(cache->entries);
+    free(cache->keys);
+    free(cache->buckets);
+    free(cache->bucketGenerations);
+    cache->entries = NULL;
+    cache->keys = NULL;
+    cache->buckets = NULL;
+    cache->bucketGenerations = NULL;
+    cache->count = 0;
+    cache->keyCapacity = 0;
+    cache->bucketsCount = 0;
+    cache->keyed = false;
+}
+
+/**
+ * @param:  cache     - cache
+ * @param:  keyLength - number of variables the loaded expression uses
+ * @brief:  Drop all entries (the loaded expression has changed), the memory and the counters are kept
+ */
+void clearResultCache(ResultCache *cache, size_t keyLength) {
+    cache->count = 0;
+    cache->keyLength = keyLength;
+    cache->newest = CACHE_NONE;
+    cache->oldest = CACHE_NONE;
+    cache->keyed = false;
+    ++cache->generation;
+}
+
+/**
+ * @param:  cache - cleared cache
+ * @return: false if there is not enough memory
+ * @brief:  Allocate the arrays of the cache once for its capacity,
+ *              the keys are reallocated only when an expression uses more variables than before
+ */
+bool reserveResultCache(ResultCache *cache) {
+    if (cache->capacity == 0) { return true; }
+
+    if (cache->entries == NULL) {
+        cache->bucketsCount = 1;
+        while (cache->bucketsCount < cache->capacity) {
+            cache->bucketsCount *= 2;
+        }
+        cache->entries = (CacheEntry *) malloc(cache->capacity * sizeof(CacheEntry));
+        cache->buckets = (size_t *) malloc(cache->bucketsCount * sizeof(size_t));
+        /// Generation 0 is never current, so all chains start empty
+        cache->bucketGenerations = (unsigned long long *) calloc(cache->bucketsCount,
+                                                                 sizeof(unsigned long long));
+        if (cache->entries == NULL || cache->buckets == NULL || cache->bucketGenerations == NULL) {
+            freeResultCache(cache);
+            return false;
+        }
+    }
+
+    if (cache->keys == NULL || cache->keyLength > cache->keyCapacity) {
+        int *keys = (int *) realloc(cache->keys, (cache->capacity * cache->keyLength + 1) * sizeof(int));
+        if (keys == NULL) { return false; }
+        cache->keys = keys;
+        cache->keyCapacity = cache->keyLength;
+    }
+    return true;
+}
+
+/// Head of the hash chain of a key (a head left from an older generation is emptied first)
+size_t *findCacheBucket(ResultCache *cache, uint64_t hash) {
+    size_t bucket = hash & (cache->bucketsCount - 1);
+    if (cache->bucketGenerations[bucket] != cache->generation) {
+        cache->bucketGenerations[bucket] = cache->generation;
+        cache->buckets[bucket] = CACHE_NONE;
+    }
+    return &cache->buckets[bucket];
+}
+
+/// Hash of the values of the used variables
+uint64_t hashCacheKey(const int *values, size_t count) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < count; ++i) {
+        hash = (hash ^ (uint32_t) values[i]) * 0x100000001B3ull;
+    }
+    return hash ^ (hash >> 29);
+}
+
+/// Take an entry out of the order of use
+void unlinkCacheEntry(ResultCache *cache, size_t index) {
+    CacheEntry *entry = &cache->entries[index];
+    if (entry->previous != CACHE_NONE) {
+        cache->entries[entry->previous].next = entry->next;
+    } else {
+        cache->newest = entry->next;
+    }
+    if (entry->next != CACHE_NONE) {
+        cache->entries[entry->next].previous = entry->previous;
+    } else {
+        cache->oldest = entry->previous;
+    }
+}
+
+/// Put an entry first in the order of use
+void linkCacheEntry(ResultCache *cache, size_t index) {
+    CacheEntry *entry = &cache->entries[index];
+    entry->previous = CACHE_NONE;
+    entry->next = cache->newest;
+    if (cache->newest != CACHE_NONE) {
+        cache->entries[cache->newest].previous = index;
+    } else {
+        cache->oldest = index;
+    }
+    cache->newest = index;
+}
+
+/**
+ * @param:  cache  - cache
+ * @param:  hash   - hash of the key
+ * @param:  values - values of the used variables
+ * @param:  result - where to put the cached value
+ * @return: true if the result is cached
+ */
+bool findCachedResult(ResultCache *cache, uint64_t hash, const int *values, int *result) {
+    if (!cache->keyed) { return false; }
+
+    size_t index = *findCacheBucket(cache, hash);
+    while (index != CACHE_NONE) {
+        CacheEntry *entry = &cache->entries[index];
+        if (entry->hash == hash &&
+            memcmp(&cache->keys[index * cache->keyLength], values, cache->keyLength * sizeof(int)) == 0) {
+            unlinkCacheEntry(cache, index);
+            linkCacheEntry(cache, index);
+            ++cache->hits;
+            *result = entry->result;
+            return true;
+        }
+        index = entry->chain;
+    }
+
+    ++cache->misses;
+    return false;
+}
+
+/**
+ * @param: cache  - cache
+ * @param: hash   - hash of the key
+ * @param: values - values of the used variables
+ * @param: result - value of the expression
+ * @brief: Remember a result, evicting the least recently used one if the cache is full
+ */
+void cacheResult(ResultCache *cache, uint64_t hash, const int *values, int result) {
+    if (!cache->keyed) { return; }
+
+    size_t index = cache->count;
+    if (cache->count < cache->capacity) {
+        ++cache->count;
+    } else {
+        index = cache->oldest;
+        unlinkCacheEntry(cache, index);
+
+        /// Take the evicted entry out of its hash chain
+        size_t *link = findCacheBucket(cache, cache->entries[index].hash);
+        while (*link != index) {
+            link = &cache->entries[*link].chain;
+        }
+        *link = cache->entries[index].chain;
+    }
+
+    CacheEntry *entry = &cache->entries[index];
+    entry->hash = hash;
+    entry->result = result;
+    memcpy(&cache->keys[index * cache->keyLength], values, cache->keyLength * sizeof(int));
+
+    size_t *bucket = findCacheBucket(cache, hash);
+    entry->chain = *bucket;
+    *bucket = index;
+    linkCacheEntry(cache, index);
+}
+
+/// Stored expression
+typedef struct Slot {
+    /// Name of the slot
+    char *name;
+    /// Expression
+    Expression *expr;
+} Slot;
+
+/// State kept between processed lines
+typedef struct Session {
+    /// Loaded expression (exactly as it was parsed)
+    Expression *expr;
+    /// Rebalanced copy of the loaded expression used for evaluation (or NULL)
+    Expression *balanced;
+    /// Whether loaded expressions are rebalanced
+    bool rebalance;
+    /// Stored expressions in the order they were first stored
+    Slot *slots;
+    size_t slotsCount;
+    /// All stored expressions compiled together (NULL until the next evaluate_all)
+    Program *program;
+    /// Packed expressions
+    PackedStore packed;
+    /// Maximum number of operations of one evaluation (0 - unlimited)
+    unsigned long long operationsLimit;
+    /// Maximum time of one evaluation in milliseconds (0 - unlimited)
+    unsigned long long timeLimit;
+    /// Names of the variables the loaded expression uses (found only while the cache is on)
+    char usedVariables[UCHAR_MAX + 1];
+    /// Results of evaluations of the loaded expression (dropped when another one is loaded)
+    ResultCache cache;
+    /// Prefix and postfix text of the loaded expression, indexed by form
+    ///     (data is NULL until the text is loaded or saved for the first time)
+    TextBuffer rendered[POSTFIX + 1];
+    /// Maximum number of nodes of a loaded expression (0 - unlimited)
+    size_t nodesLimit;
+    /// Maximum bytes of nodes of a loaded expression (0 - unlimited)
+    size_t bytesLimit;
+} Session;
+
+/**
+ * @param:  evaluation - finished evaluation
+ * @param:  out        - output file
+ * @return: true if the evaluation failed and the error is output instead of the value
+ */
+bool reportEvaluationError(const Evaluation *evaluation, FILE *out) {
+    switch (evaluation->error) {
+        case NO_ERROR:
+            return false;
+        case OVERFLOW_ERROR:
+            fprintf(out, OVERFLOW_EXCEPTION);
+            return true;
+        case BUDGET_ERROR:
+            fprintf(out, BUDGET_EXCEPTION);
+            return true;
+        case DIVISION_ERROR:
+            fprintf(out, DIVISION_EXCEPTION);
+            return true;
+        case UNBOUND_ERROR:
+        case MEMORY_ERROR:
+            fprintf(out, INVALID_EXCEPTION);
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @param:  session - state with the stored expressions
+ * @param:  name    - name of the slot
+ * @param:  expr    - expression to be stored (the slot takes ownership)
+ * @return: false if there is not enough memory
+ * @brief:  Put an expression into a slot, replacing the previous one with the same name
+ */
+bool storeExpression(Session *session, const char *name, Expression *expr) {
+    for (size_t i = 0; i < session->slotsCount; ++i) {
+        if (strcmp(session->slots[i].name, name) == 0) {
+            freeExpression(session->slots[i].expr);
+            session->slots[i].expr = expr;
+            freeProgram(session->program);
+            session->program = NULL;
+            return true;
+        }
+    }
+
+    Slot slot;
+    slot.name = (char *) malloc(strlen(name) + 1);
+    if (slot.name == NULL) { return false; }
+    strcpy(slot.name, name);
+    slot.expr = expr;
+
+    Slot *newSlots = (Slot *) realloc(
+            session->slots,
+            (session->slotsCount + 1) * sizeof(Slot)
+    );
+    if (newSlots == NULL) {
+        free(slot.name);
+        return false;
+    }
+    session->slots = newSlots;
+    session->slots[session->slotsCount++] = slot;
+
+    freeProgram(session->program);
+    session->program = NULL;
+    return true;
+}
+
+/**
+ * @param:  session - state with the stored expressions
+ * @param:  context - variable values
+ * @param:  out     - output file
+ * @brief:  Evaluate all stored expressions in a single pass
+ *              and output name=value for each of them in one line
+ *                  (name=<error> for those that could not be calculated).
+ *          If there is not enough memory, incorrect is output.
+ */
+void evaluateAll(Session *session, const Context *context, FILE *out) {
+    if (session->program == NULL) {
+        Expression **expressions = (Expression **) malloc(session->slotsCount * sizeof(Expression *));
+        if (expressions != NULL) {
+            for (size_t i = 0; i < session->slotsCount; ++i) {
+                expressions[i] = session->slots[i].expr;
+            }
+            session->program = compileProgram(expressions, session->slotsCount);
+            free(expressions);
+        }
+    }
+
+    Program *program = session->program;
+    int *values = NULL;
+    EvaluationError *errors = NULL;
+    if (program != NULL) {
+        values = (int *) malloc((program->instructionsCount + 1) * sizeof(int));
+        errors = (EvaluationError *) malloc((program->instructionsCount + 1) * sizeof(EvaluationError));
+    }
+
+    if (values == NULL || errors == NULL) {
+        fprintf(out, INVALID_EXCEPTION);
+    } else {
+        runProgram(program, context, values, errors);
+        for (size_t i = 0; i < program->resultsCount; ++i) {
+            fprintf(out, i == 0 ? "%s=" : ",%s=", session->slots[i].name);
+            switch (errors[program->results[i]]) {
+                case NO_ERROR:
+                    fprintf(out, "%d", values[program->results[i]]);
+                    break;
+                case OVERFLOW_ERROR:
+                    fprintf(out, OVERFLOW_RESULT);
+                    break;
+                case BUDGET_ERROR:
+                    fprintf(out, BUDGET_RESULT);
+                    break;
+                case DIVISION_ERROR:
+                    fprintf(out, DIVISION_RESULT);
+                    break;
+                case UNBOUND_ERROR:
+                case MEMORY_ERROR:
+                    fprintf(out, INVALID_RESULT);
+                    break;
+            }
+        }
+        fprintf(out, "\n");
+    }
+    free(values);
+    free(errors);
+}
+
+/// Build (or drop) the rebalanced copy of the loaded expression
+void updateBalanced(Session *session) {
+    freeExpression(session->balanced);
+    session->balanced = NULL;
+
+    if (session->rebalance && session->expr) {
+        /// If there is not enough memory, the loaded expression is evaluated as is
+        session->balanced = rebalanceExpression(session->expr);
+    }
+}
+
+/**
+ * @param:  session - state with the loaded expression
+ * @return: false if the cache is on but there is not enough memory for it
+ * @brief:  Find the variables of the loaded expression (the key of its results) and drop the cached results
+ */
+bool updateExpressionKey(Session *session) {
+    /// Without a cache the expression is not walked at all
+    bool used[UCHAR_MAX + 1] = {false};
+    bool cached = session->cache.capacity > 0;
+    bool marked = !cached || session->expr == NULL || markVariables(session->expr, used);
+
+    size_t count = 0;
+    for (int name = 1; name <= UCHAR_MAX; ++name) {
+        if (used[name]) {
+            session->usedVariables[count++] = (char) name;
+        }
+    }
+    session->usedVariables[count] = '\0';
+    clearResultCache(&session->cache, count);
+    bool reserved = !cached || reserveResultCache(&session->cache);
+    /// If the key is unknown, nothing may be cached
+    session->cache.keyed = cached && session->expr != NULL && marked && reserved;
+    return marked && reserved;
+}
+
+/**
+ * @param: session - state with the loaded expression
+ * @param: expr    - newly parsed expression (NULL if the input is incorrect)
+ * @param: out     - output file
+ * @brief: Replace the loaded expression and output the result of loading to a file
+ */
+void setLoadedExpression(Session *session, Expression *expr, FILE *out) {
+    assert(session);
+
+    // Free memory from previous expression
+    if (session->expr) {
+        freeExpression(session->expr);
+    }
+
+    session->expr = expr;
+    updateBalanced(session);
+    /// If there is not enough memory for the cache, the expression is evaluated without it
+    updateExpressionKey(session);
+    for (int form = NATURAL; form <= POSTFIX; ++form) {
+        free(session->rendered[form].data);
+        memset(&session->rendered[form], 0, sizeof(TextBuffer));
+    }
+    if (session->expr == NULL) {
+        fprintf(out,
+                INVALID_EXCEPTION
+        );
+    } else {
+        fprintf(out,
+                SUCCESS
+        );
+    }
+}
+
+/**
+ * @param:  begin - beginning of the text of a successfully parsed expression
+ * @param:  end   - where parsing ended
+ * @return: true if printing the parsed expression gives exactly the same text
+ * @details: The parser checks the structure of prefix and postfix forms,
+ *              so only literals may be written differently:
+ *                  with leading zeros or too big for int.
+ */
+bool isCanonicalSource(const char *begin, const char *end) {
+    while (begin < end) {
+        if (!isdigit(*begin)) {
+            ++begin;
+            continue;
+        }
+
+        const char *digits = begin;
+        long long value = 0;
+        while (begin < end && isdigit(*begin)) {
+            value = value * 10 + (*begin - '0');
+            if (value > INT_MAX) { return false; }
+            ++begin;
+        }
+        if (*digits == '0' && begin - digits > 1) { return false; }
+    }
+    return true;
+}
+
+/**
+ * @param: session - state with the loaded expression
+ * @param: form    - form of expression
+ * @param: out     - output file
+ * @brief: Loading an expression in the specified form and outputting the result to a file
+ */
+void loadExpression(Session *session, Form form, FILE *out) {
+    // Expression parsing
+    char *expression = strtok(
+            NULL, // NULL - continue parsing the previous line
+            " "
+    );
+    /// No node is allocated for incorrect or too big expressions
+    if (!validateExpression(expression, form, session->nodesLimit, session->bytesLimit)) {
+        setLoadedExpression(session, NULL, out);
+        return;
+    }
+
+    const char *end = NULL;
+    setLoadedExpression(session, parseExpression(expression, &end, form), out);
+
+    /// The validated text is exactly what saving in the same form would print,
+    ///     so it is kept instead of being printed again
+    if (session->expr != NULL && form != NATURAL && isCanonicalSource(expression, end)) {
+        appendText(&session->rendered[form], expression, (size_t) (end - expression));
+    }
+}
+
+/**
+ * @param: session - state with the loaded expression
+ * @param: form    - record form
+ * @param: out     - output file
+ * @return: false if there is not enough memory (nothing is output)
+ * @brief: Storing the loaded expression in prefix or postfix form.
+ *             The text is rendered once, then the same bytes are written on every save.
+ */
+bool saveExpression(Session *session, Form form, FILE *out) {
+    TextBuffer *rendered = &session->rendered[form];
+    if (rendered->data == NULL && !renderExpression(rendered, session->expr, form)) {
+        /// Not enough memory to keep the text
+        free(rendered->data);
+        memset(rendered, 0, sizeof(TextBuffer));
+        return printExpression(out, session->expr, form);
+    }
+
+    fwrite(rendered->data, 1, rendered->size, out);
+    return true;
+}
+
+/**
+ * @param: context    - context to be filled
+ * @param: evaluation - limits of the evaluation in this context
+ * @brief: Reading variable values (x=1,y=2 ...) from the rest of the line
+ */
+void readContext(Context *context, Evaluation *evaluation) {
+    context->evaluation = evaluation;
+    context->variablesNames = (char *) malloc(1);
+    context->variablesNames[0] = '\0';
+    context->variablesValues = (int *) malloc(0);
+
+    char *var = strtok(NULL, " ,");
+    while (var) {
+        char name = var[0];
+        int value = atoi(var + 2);
+
+        size_t varsCount = strlen(context->variablesNames);
+        char *newNames = (char *) realloc(
+                context->variablesNames,
+                varsCount + 2
+        );
+        assert(newNames != NULL);
+        context->variablesNames = newNames;
+        context->variablesNames[varsCount] = name;
+        context->variablesNames[varsCount + 1] = '\0';
+
+        int *newValues = (int *) realloc(
+                context->variablesValues,
+                (varsCount + 1) * sizeof(int)
+        );
+        assert(newValues != NULL);
+        context->variablesValues = newValues;
+        context->variablesValues[varsCount] = value;
+
+        var = strtok(NULL, " ,");
+    }
+}
+
+/// Release the memory of a context
+void freeContext(Context *context) {
+    free(context->variablesNames);
+    free(context->variablesValues);
+}
+
+/**
+ * @param:  session - state with the packed expressions
+ * @param:  index   - where to put the index read from the rest of the line
+ * @return: false if there is no such packed expression
+ */
+bool readPackedIndex(const Session *session, size_t *index) {
+    char *number = strtok(NULL, " ");
+    if (number == NULL || !isdigit(*number)) { return false; }
+
+    char *end = NULL;
+    unsigned long long value = strtoull(number, &end, 10);
+    if (*end != '\0' || value >= session->packed.expressionsCount) { return false; }
+
+    *index = (size_t) value;
+    return true;
+}
+
+/**
+ * @param: line    - a string read from a file or command line
+ * @param: session - state kept between lines (loaded expression, options)
+ * @param: out     - output file
+ * @brief: processing the line itself
+ */
+void processLine(char *line, Session *session, FILE *out) {
+    assert(session);
+
+//    split string by spaces
+    char *command = strtok(line, " ");
+//    parse the command
+    Command cmd = parseCommand(command);
+    switch (cmd) {
+        case PARSE: {
+            loadExpression(session, NATURAL, out);
+            return;
+        }
+        case LOAD_PRF: {
+            loadExpression(session, PREFIX, out);
+            return;
+        }
+        case LOAD_PST: {
+            loadExpression(session, POSTFIX, out);
+            return;
+        }
+        case SAVE_PRF: {
+            if (session->expr == NULL) {
+                fprintf(out,
+                        NOT_LOADED_EXCEPTION
+                );
+                return;
+            }
+
+            fprintf(out, saveExpression(session, PREFIX, out) ? "\n" : INVALID_EXCEPTION);
+            return;
+        }
+        case SAVE_PST: {
+            if (session->expr == NULL) {
+                fprintf(out,
+                        NOT_LOADED_EXCEPTION
+                );
+                return;
+            }
+
+            fprintf(out, saveExpression(session, POSTFIX, out) ? "\n" : INVALID_EXCEPTION);
+            return;
+        }
+        case EVALUATE: {
+            if (session->expr == NULL) {
+                fprintf(out,
+                        NOT_LOADED_EXCEPTION
+                );
+                return;
+            }
+
+            Evaluation evaluation;
+            startEvaluation(&evaluation, session->operationsLimit, session->timeLimit);
+            Context context;
+            readContext(&context, &evaluation);
+
+            /// Only the variables the expression uses are a part of the key,
+            ///     so extra bindings do not matter
+            int values[UCHAR_MAX + 1];
+            bool cacheable = session->cache.keyed;
+            for (size_t i = 0; cacheable && session->usedVariables[i] != '\0'; ++i) {
+                cacheable = findVariable(&context, session->usedVariables[i], &values[i]);
+            }
+
+            int result = 0;
+            uint64_t hash = 0;
+            if (cacheable) {
+                hash = hashCacheKey(values, session->cache.keyLength);
+                if (findCachedResult(&session->cache, hash, values, &result)) {
+                    fprintf(out, "%d\n", result);
+                    freeContext(&context);
+                    return;
+                }
+            }
+
+            Expression *evaluated = session->balanced ? session->balanced : session->expr;
+            result = evaluate(evaluated, &context);
+            if (!reportEvaluationError(&evaluation, out)) {
+                fprintf(out, "%d\n", result);
+                if (cacheable) {
+                    cacheResult(&session->cache, hash, values, result);
+                }
+            }
+
+            freeContext(&context);
+            return;
+        }
+        case STORE: {
+            char *name = strtok(NULL, " ");
+            if (name == NULL) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+            if (session->expr == NULL) {
+                fprintf(out,
+                        NOT_LOADED_EXCEPTION
+                );
+                return;
+            }
+
+            /// Not enough memory: the slots are left as they were
+            Expression *copy = copyExpression(session->expr);
+            if (copy == NULL || !storeExpression(session, name, copy)) {
+                freeExpression(copy);
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+            fprintf(out, SUCCESS);
+            return;
+        }
+        case EVALUATE_ALL: {
+            if (session->slotsCount == 0) {
+                fprintf(out,
+                        NOT_LOADED_EXCEPTION
+                );
+                return;
+            }
+
+            Evaluation evaluation;
+            startEvaluation(&evaluation, session->operationsLimit, session->timeLimit);
+            Context context;
+            readContext(&context, &evaluation);
+            evaluateAll(session, &context, out);
+            freeContext(&context);
+            return;
+        }
+        case PACK: {
+            if (session->expr == NULL) {
+                fprintf(out,
+                        NOT_LOADED_EXCEPTION
+                );
+                return;
+            }
+
+            size_t index = 0;
+            if (!packExpression(&session->packed, session->expr, &index)) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+            fprintf(out, "%zu\n", index);
+            return;
+        }
+        case EVALUATE_PACKED: {
+            size_t index = 0;
+            if (!readPackedIndex(session, &index)) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+
+            Evaluation evaluation;
+            startEvaluation(&evaluation, session->operationsLimit, session->timeLimit);
+            Context context;
+            readContext(&context, &evaluation);
+            int result = 0;
+            if (!evaluatePacked(&session->packed, index, &context, &result)) {
+                fprintf(out, INVALID_EXCEPTION);
+            } else if (!reportEvaluationError(&evaluation, out)) {
+                fprintf(out, "%d\n", result);
+            }
+            freeContext(&context);
+            return;
+        }
+        case SAVE_PACKED_PRF:
+        case SAVE_PACKED_PST: {
+            size_t index = 0;
+            if (!readPackedIndex(session, &index)) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+
+            Form form = cmd == SAVE_PACKED_PRF ? PREFIX : POSTFIX;
+            fprintf(out, printPacked(out, &session->packed, index, form) ? "\n" : INVALID_EXCEPTION);
+            return;
+        }
+        case EVAL_BUDGET: {
+            /// eval_budget <operations> <milliseconds>, 0 - unlimited
+            char *operations = strtok(NULL, " ");
+            char *milliseconds = strtok(NULL, " ");
+            if (operations == NULL || milliseconds == NULL ||
+                !isdigit(*operations) || !isdigit(*milliseconds)) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+
+            session->operationsLimit = strtoull(operations, NULL, 10);
+            session->timeLimit = strtoull(milliseconds, NULL, 10);
+            fprintf(out, SUCCESS);
+            return;
+        }
+        case EVAL_CACHE: {
+            /// eval_cache <entries>, 0 - no cache
+            char *entries = strtok(NULL, " ");
+            if (entries == NULL || !isdigit(*entries)) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+
+            unsigned long long capacity = strtoull(entries, NULL, 10);
+            if (capacity > CACHE_MAX_ENTRIES) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+
+            if (session->cache.capacity != capacity) {
+                freeResultCache(&session->cache);
+                session->cache.capacity = (size_t) capacity;
+            }
+            if (!updateExpressionKey(session)) {
+                /// Not enough memory: the cache is turned off
+                freeResultCache(&session->cache);
+                session->cache.capacity = 0;
+                updateExpressionKey(session);
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+            fprintf(out, SUCCESS);
+            return;
+        }
+        case EVAL_CACHE_STATS: {
+            unsigned long long lookups = session->cache.hits + session->cache.misses;
+            fprintf(out, "hits=%llu,misses=%llu,hit_rate=%.2f\n",
+                    session->cache.hits,
+                    session->cache.misses,
+                    lookups == 0 ? 0.0 : (double) session->cache.hits / (double) lookups);
+            return;
+        }
+        case LOAD_BUDGET: {
+            /// load_budget <nodes> <bytes>, 0 - unlimited
+            char *nodes = strtok(NULL, " ");
+            char *bytes = strtok(NULL, " ");
+            if (nodes == NULL || bytes == NULL || !isdigit(*nodes) || !isdigit(*bytes)) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+
+            session->nodesLimit = (size_t) strtoull(nodes, NULL, 10);
+            session->bytesLimit = (size_t) strtoull(bytes, NULL, 10);
+            fprintf(out, SUCCESS);
+            return;
+        }
+        case REBALANCE: {
+            char *mode = strtok(NULL, " ");
+            if (mode == NULL || (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)) {
+                fprintf(out, INVALID_EXCEPTION);
+                return;
+            }
+
+            session->rebalance = strcmp(mode, "on") == 0;
+            updateBalanced(session);
+            fprintf(out, SUCCESS);
+            return;
+        }
+        case INVALID: {
+            fprintf(out, INVALID_EXCEPTION);
+            return;
+        }
+    };
+}
+
+/**
+ * @param: parser - parser the expression is fed to (NULL - the line is skipped)
+ * @param: chunk  - part of the line that is already read (NULL - nothing is read yet)
+ * @param: line   - buffer the rest of the line is read into
+ * @param: size   - size of the buffer
+ * @param: in     - input file
+ * @brief: Feeding the expression of a long line to a parser chunk by chunk up to the end of the line.
+ *             The expression starts after the spaces and ends at the first space after it,
+ *                 just as with strtok in loadExpression (the spaces may be split between chunks too).
+ */
+void feedLongLine(StreamParser *parser, char *chunk, char *line, size_t size, FILE *in) {
+    bool expressionStarted = false;
+    bool expressionEnded = false;
+    bool lineEnded = false;
+    while (!lineEnded) {
+        if (chunk != NULL) {
+            size_t length = strlen(chunk);
+            if (length > 0 && chunk[length - 1] == '\n') {
+                lineEnded = true;
+                --length;
+            }
+
+            if (!expressionStarted) {
+                size_t spaces = strspn(chunk, " ");
+                chunk += spaces;
+                length -= spaces;
+                expressionStarted = length > 0;
+            }
+            if (parser != NULL && expressionStarted && !expressionEnded) {
+                size_t expressionLength = strcspn(chunk, " \r\n");
+                expressionEnded = expressionLength < length;
+                feedStreamParser(parser, chunk, expressionEnded ? expressionLength : length);
+            }
+        }
+
+        if (!lineEnded) {
+            chunk = fgets(line, (int) size, in);
+            lineEnded = chunk == NULL;
+        }
+    }
+}
+
+/**
+ * @param: line    - beginning of a line that did not fit into the buffer
+ * @param: size    - size of the buffer
+ * @param: in      - input file the rest of the line is read from
+ * @param: session - state kept between lines
+ * @param: out     - output file
+ * @brief: Processing a line that is longer than the buffer.
+ *             The line is never kept in memory as a whole: it is read once to check the expression
+ *                 and, only if it is correct and fits into the limits, once more to build the tree.
+ */
+void processLongLine(char *line, size_t size, FILE *in, Session *session, FILE *out) {
+    char *command = strtok(line, " ");
+    Command cmd = command ? parseCommand(command) : INVALID;
+
+    Form form = NATURAL;
+    switch (cmd) {
+        case PARSE:
+            form = NATURAL;
+            break;
+        case LOAD_PRF:
+            form = PREFIX;
+            break;
+        case LOAD_PST:
+            form = POSTFIX;
+            break;
+        default:
+            cmd = INVALID;
+            break;
+    }
+
+    /// The first chunk has no newline, so it takes exactly as many bytes in the file as it has characters
+    char *chunk = strtok(NULL, "");
+    long start = ftell(in);
+    if (start >= 0 && chunk != NULL) {
+        start -= (long) strlen(chunk);
+    }
+
+    StreamParser validator;
+    initStreamParser(&validator, form);
+    validator.validateOnly = true;
+    limitStreamParser(&validator, session->nodesLimit, session->bytesLimit);
+    feedLongLine(cmd == INVALID ? NULL : &validator, chunk, line, size, in);
+    bool valid = completeStreamParser(&validator);
+    freeStreamParser(&validator);
+
+    if (cmd == INVALID) {
+        fprintf(out, INVALID_EXCEPTION);
+        return;
+    }
+    /// The expression is incorrect, too big or cannot be read again
+    if (!valid || start < 0 || fseek(in, start, SEEK_SET) != 0) {
+        setLoadedExpression(session, NULL, out);
+        return;
+    }
+
+    StreamParser parser;
+    initStreamParser(&parser, form);
+    feedLongLine(&parser, NULL, line, size, in);
+    setLoadedExpression(session, finishStreamParser(&parser), out);
+}
+
+int main(int argc, const char *argv[]) {
+    Session session = {0};
     if (argc == 1) {
         FILE *in = fopen(INPUT_FILE, "r");
         if (in == NULL) {
@@ -816,15 +3629,18 @@ int main(int argc, const char *argv[]) {
             /// Remove newline character
             if (len > 0 && line[len - 1] == '\n') {
                 line[len - 1] = '\0';
+            } else if (!feof(in)) {
+                processLongLine(line, sizeof(line), in, &session, out);
+                continue;
             }
 
-            processLine(line, &expr, out);
+            processLine(line, &session, out);
         };
     } else {
         for (int i = 1; i < argc; ++i) {
             char line[256] = {0};
             strcpy(line, argv[i]);
-            processLine(line, &expr, stdout);
+            processLine(line, &session, stdout);
         }
     }
     return 0;